@@ -0,0 +1,323 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <chrono>
+#include <fake_board.h>
+#include <fake_tap_entry.h>
+#include <new>
+
+#include "scales.h"
+
+// Host microbenchmarks of the hot paths of the firmware, with full recordings of
+// RECORDING_ENTRY_NUM_RAW_DATA_ITEMS points. Each benchmark prints a JSON line with
+// the time and the heap allocations per operation, so that runs can be compared.
+
+#define DATA_PIN 4
+#define RECORDER_INDEX 1
+#define RENDER_BUFFER_SIZE 16384
+// the firmware used 1024 bytes, which held only part of a full recording
+#define DOCUMENT_RENDER_JSON_SIZE 65536
+
+static uint64_t numAllocs = 0;
+static uint64_t allocatedBytes = 0;
+
+// Counts everything taken from the heap, including ArduinoJson and the arena fallbacks
+// which use malloc() directly. Elsewhere only the allocations through new are counted.
+#ifdef __GLIBC__
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t num, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+  ++numAllocs;
+  allocatedBytes += size;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t num, size_t size) {
+  ++numAllocs;
+  allocatedBytes += num * size;
+  return __libc_calloc(num, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  ++numAllocs;
+  allocatedBytes += size;
+  return __libc_realloc(ptr, size);
+}
+}
+#else
+void *operator new(size_t size) {
+  ++numAllocs;
+  allocatedBytes += size;
+  void *ptr = malloc(size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void *ptr, size_t size) noexcept {
+  free(ptr);
+}
+#endif
+
+// Runs the given number of rounds of operations, where only the operations are measured,
+// and the reset between the rounds is not. One round runs before the measurement to warm up.
+template <typename Reset, typename Op>
+void bench(const char *name, int numRounds, int opsPerRound, Reset reset, Op op) {
+  uint64_t nanos = 0;
+  uint64_t allocs = 0;
+  uint64_t bytes = 0;
+
+  for (int round = -1; round < numRounds; ++round) {
+    reset();
+    uint64_t allocsBefore = numAllocs;
+    uint64_t bytesBefore = allocatedBytes;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < opsPerRound; ++i) {
+      op(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    if (round >= 0) {
+      nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+      allocs += numAllocs - allocsBefore;
+      bytes += allocatedBytes - bytesBefore;
+    }
+  }
+
+  double numOps = (double) numRounds * opsPerRound;
+  printf(
+    "{\"benchmark\":\"%s\",\"ops\":%.0f,\"nsPerOp\":%.1f,\"allocsPerOp\":%.3f,\"bytesPerOp\":%.1f}\n",
+    name, numOps, nanos / numOps, allocs / numOps, bytes / numOps
+  );
+  fflush(stdout);
+}
+
+template <typename Op>
+void bench(const char *name, int numRounds, int opsPerRound, Op op) {
+  bench(name, numRounds, opsPerRound, []() {}, op);
+}
+
+// the mass of the given point of a recording
+float massOfPoint(int value) {
+  return massOf(((float) value) / MEASURED_POINTS_IN_LITERS);
+}
+
+// records all the points from the largest volume, a second apart, so that none share their key
+void fillRecording(Recorder &recorder, int index) {
+  for (int value = RECORDING_ENTRY_NUM_RAW_DATA_ITEMS - 1; value >= 0; --value) {
+    advanceMillis(1000);
+    recorder.update(index, massOfPoint(value));
+  }
+}
+
+class ScalesBenchmark {
+
+private:
+  Scales &scales;
+  Recorder &recorder;
+
+public:
+  ScalesBenchmark(Scales &_scales, Recorder &_recorder) : scales(_scales), recorder(_recorder) {}
+
+  AsyncWebSocketMessageBuffer *scaleToJson(bool isFullRender) {
+    return this->scales.scaleToJson(this->scales.scales[0], isFullRender);
+  }
+
+  // The render of the recording scale the way the firmware did it before the JsonWriter,
+  // building a document, then measuring and serializing it into a message buffer.
+  AsyncWebSocketMessageBuffer *scaleToDocument(bool isFullRender) {
+    static StaticJsonDocument<DOCUMENT_RENDER_JSON_SIZE> doc;
+    doc.clear();
+    Scale *scale = this->scales.scales[0];
+    RecordingEntry *entry = this->recorder.entries[0];
+
+    doc["type"] = "data";
+    doc["index"] = 0;
+    doc["isFull"] = isFullRender;
+    JsonObject state = doc.createNestedObject("state");
+    state["data"] = scale->getAdcData();
+    state["name"] = "recording";
+    state["isPaused"] = false;
+
+    state["isPaused"] = entry->isPaused;
+    state["recordingId"] = entry->id;
+    if (isFullRender) {
+      state["startDateTime"] = DateFormatter::format(DateFormatter::SIMPLE, entry->startDateTime);
+      JsonObject tapEntry = state.createNestedObject("tapEntry");
+      tapEntry["id"] = entry->tapEntry.id;
+      tapEntry["number"] = entry->tapEntry.number;
+      tapEntry["name"] = entry->tapEntry.name;
+      tapEntry["bottlingDate"] = DateFormatter::format(DateFormatter::DATE_ONLY, entry->tapEntry.bottlingDate);
+      tapEntry["bottlingVolume"] = entry->tapEntry.bottlingVolume;
+      tapEntry["useBottlingVolume"] = entry->tapEntry.useBottlingVolume;
+      tapEntry["tareOffset"] = entry->tapEntry.tareOffset;
+      tapEntry["finalGravity"] = entry->tapEntry.finalGravity;
+      tapEntry["abv"] = entry->tapEntry.abv;
+      tapEntry["srm"] = entry->tapEntry.srm;
+    }
+
+    // the recorded data takes the place of the live measurement
+    time_t now = Clock.now();
+    JsonObject data = state.createNestedObject("data");
+    for (int i = 0; i < RECORDING_ENTRY_NUM_RAW_DATA_ITEMS; ++i) {
+      time_t timestamp = entry->rawData[i];
+      if (timestamp != 0 && (isFullRender || now - timestamp < MAX_PARTIAL_RENDER_TIME_DELAY_SECONDS)) {
+        data[String(timestamp)] = ((float) i) / MEASURED_POINTS_IN_LITERS;
+      }
+    }
+
+    size_t len = measureJson(doc);
+    AsyncWebSocketMessageBuffer *buffer = this->scales.socket.makeBuffer(len);
+    serializeJson(doc, (char *) buffer->get(), len + 1);
+    return buffer;
+  }
+
+  // the writer has to render the same bytes as the document
+  bool isRenderIdentical(bool isFullRender) {
+    AsyncWebSocketMessageBuffer *written = this->scaleToJson(isFullRender);
+    AsyncWebSocketMessageBuffer *serialized = this->scaleToDocument(isFullRender);
+    bool isIdentical = written->length() == serialized->length()
+      && memcmp(written->get(), serialized->get(), written->length()) == 0;
+    printf(
+      "{\"check\":\"scale_render_%s_identical\",\"bytes\":%u,\"documentBytes\":%u,\"isIdentical\":%s}\n",
+      isFullRender ? "full" : "partial",
+      (unsigned int) written->length(),
+      (unsigned int) serialized->length(),
+      isIdentical ? "true" : "false"
+    );
+    fflush(stdout);
+    return isIdentical;
+  }
+
+  // lets the next command in, the way the loop applies it on the board
+  void dropPendingState() {
+    this->scales.scales[0]->setState(nullptr);
+  }
+
+  // lets the socket free the renders which piled up, which it does only when sending to all clients
+  void releaseBuffers() {
+    HeapStats.handle();
+    this->scales.socket.textAll(this->scales.socket.makeBuffer(0));
+  }
+};
+
+int main() {
+  resetFakeBoard();
+  syncClock();
+  setLoadCell(DATA_PIN, massOf(20));
+
+  Config config;
+  ScaleConfig scaleConfig = {};
+  strlcpy(scaleConfig.label, "Left", sizeof(scaleConfig.label));
+  scaleConfig.dataPin = DATA_PIN;
+  scaleConfig.clockPin = DATA_PIN + 1;
+  scaleConfig.gain = 128;
+  config.scales.assign(1, scaleConfig);
+
+  PersistentConfig persistentConfig;
+  persistentConfig.load(config.scales);
+  // the scale records on the first one, the recorder benchmarks use the second one
+  Recorder recorder;
+  recorder.load(2);
+  Scales scales;
+  scales.begin(config, persistentConfig, recorder);
+
+  // standby, then recording with all the points
+  for (int i = 0; i < 3; ++i) {
+    scales.handle();
+    advanceMillis(100);
+  }
+  String errorMessage;
+  {
+    StaticJsonDocument<MAX_COMMAND_JSON_SIZE> doc;
+    deserializeJson(doc, "{\"action\":\"startRecording\",\"index\":0,\"tapEntry\":" TAP_ENTRY_JSON "}");
+    JsonObject command = doc.as<JsonObject>();
+    scales.processCommand(command, errorMessage);
+  }
+  scales.handle();
+  fillRecording(recorder, 0);
+
+  static char renderBuffer[RENDER_BUFFER_SIZE];
+  bench("recording_render_data", 50, 100, [&](int i) {
+    JsonWriter writer(renderBuffer, sizeof(renderBuffer));
+    writer.beginObject();
+    recorder.renderData(0, writer, 0);
+    writer.endObject();
+  });
+
+  // the partial renders get the points of the last seconds of the recording, so they run before any other
+  ScalesBenchmark scalesBenchmark(scales, recorder);
+  bool isRenderIdentical = scalesBenchmark.isRenderIdentical(true);
+  isRenderIdentical = scalesBenchmark.isRenderIdentical(false) && isRenderIdentical;
+  bench("scale_to_json_full", 50, 100, [&]() {
+    scalesBenchmark.releaseBuffers();
+  }, [&](int i) {
+    scalesBenchmark.scaleToJson(true);
+  });
+  bench("scale_to_json_partial", 50, 100, [&]() {
+    scalesBenchmark.releaseBuffers();
+  }, [&](int i) {
+    scalesBenchmark.scaleToJson(false);
+  });
+  bench("scale_to_document_full", 50, 100, [&]() {
+    scalesBenchmark.releaseBuffers();
+  }, [&](int i) {
+    scalesBenchmark.scaleToDocument(true);
+  });
+  bench("scale_to_document_partial", 50, 100, [&]() {
+    scalesBenchmark.releaseBuffers();
+  }, [&](int i) {
+    scalesBenchmark.scaleToDocument(false);
+  });
+  scalesBenchmark.releaseBuffers();
+
+  recorder.start(RECORDER_INDEX, makeEntry(), massOf(20));
+  bench("recorder_update_point", 50, RECORDING_ENTRY_NUM_RAW_DATA_ITEMS, [&]() {
+    recorder.stop(RECORDER_INDEX);
+    recorder.start(RECORDER_INDEX, makeEntry(), massOf(20));
+  }, [&](int i) {
+    advanceMillis(1000);
+    recorder.update(RECORDER_INDEX, massOfPoint(RECORDING_ENTRY_NUM_RAW_DATA_ITEMS - 1 - i));
+  });
+  // the usual case, when nothing was drawn since the last point
+  bench("recorder_update_unchanged", 50, 1000, [&](int i) {
+    recorder.update(RECORDER_INDEX, massOfPoint(1));
+  });
+
+  StaticJsonDocument<512> tapEntryDoc;
+  deserializeJson(tapEntryDoc, TAP_ENTRY_JSON);
+  JsonObject tapEntryObj = tapEntryDoc.as<JsonObject>();
+  TapEntry tapEntry;
+  bench("tap_entry_from_json", 50, 1000, [&](int i) {
+    TapEntry::fromJson(tapEntryObj, tapEntry);
+  });
+
+  // the way the socket handles commands, from the received frame to the next state of the scale and the response
+  AsyncWebSocketClient client;
+  client.isKeepingMessages = false;
+  AsyncWebServerRequest request;
+  scales.getSocket()->connect(&client, &request);
+  auto releaseResponses = [&]() {
+    client.acknowledgeAll();
+    scalesBenchmark.releaseBuffers();
+  };
+  const char *continuePayload = "{\"id\":1,\"action\":\"continueRecording\",\"index\":0}";
+  const char *startPayload = "{\"id\":1,\"action\":\"startRecording\",\"index\":0,\"tapEntry\":" TAP_ENTRY_JSON "}";
+  bench("command_continue_recording", 50, 1000, releaseResponses, [&](int i) {
+    scales.getSocket()->receive(&client, continuePayload);
+    scalesBenchmark.dropPendingState();
+  });
+  bench("command_start_recording", 50, 1000, releaseResponses, [&](int i) {
+    scales.getSocket()->receive(&client, startPayload);
+    scalesBenchmark.dropPendingState();
+  });
+  scales.getSocket()->disconnect(&client);
+
+  return isRenderIdentical ? 0 : 1;
+}
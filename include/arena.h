@@ -0,0 +1,115 @@
+#ifndef KEG_SCALE__ARENA_H
+#define KEG_SCALE__ARENA_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <cstddef>
+#include <umm_malloc/umm_heap_select.h>
+
+#include "heap_stats.h"
+
+#define ARENA_MAX_SLOTS 32
+
+// Fixed-size slots for long-lived objects, reserved in one block of the secondary IRAM heap,
+// so that they neither fragment the DRAM heap nor each other. When all slots are taken,
+// allocations fall back to the IRAM heap, and then to the DRAM heap.
+class SlotArena {
+
+private:
+  static SlotArena *first;
+
+  const char *name;
+  HeapTag tag;
+  size_t slotSize;
+  size_t numSlots;
+  uint8_t *block;
+  uint32_t usedSlots; // one bit per slot
+  size_t numUsedSlots;
+  size_t peakUsedSlots;
+  uint32_t numFallbacks;
+  SlotArena *next;
+
+  bool isInBlock(void *ptr) {
+    return this->block != nullptr && ptr >= this->block && ptr < this->block + this->slotSize * this->numSlots;
+  }
+
+public:
+  SlotArena(const char *_name, HeapTag _tag, size_t _slotSize);
+
+  // reserves the slots once, usually for the number of scales, later calls keep them
+  void begin(size_t _numSlots);
+
+  void *allocate(size_t size);
+  // the size is needed to account the fallback allocations
+  void deallocate(void *ptr, size_t size);
+
+  void render(JsonObject obj) const;
+
+  // renders the arenas by their names
+  static void renderAll(JsonObject obj);
+};
+
+// Places the pool of ArduinoJson documents in the IRAM heap, e.g. IramJsonDocument doc(1024),
+// or in the DRAM heap when it does not fit there. Documents without a pool have zero capacity.
+// The size of each pool is kept in front of it, as the documents free them without one.
+struct IramJsonAllocator {
+  union Header {
+    size_t size;
+    std::max_align_t alignment;
+  };
+
+  void *allocate(size_t size) {
+    Header *header;
+    {
+      HeapSelectIram ephemeral;
+      header = (Header *) malloc(sizeof(Header) + size);
+    }
+    if (header == nullptr) {
+      HeapSelectDram ephemeral;
+      header = (Header *) malloc(sizeof(Header) + size);
+    }
+    if (header == nullptr) {
+      return nullptr;
+    }
+    header->size = size;
+    HeapStats.add(HeapTag::Json, size);
+    return header + 1;
+  }
+
+  void deallocate(void *ptr) {
+    if (ptr == nullptr) {
+      return;
+    }
+    Header *header = (Header *) ptr - 1;
+    HeapStats.remove(HeapTag::Json, header->size);
+    free(header);
+  }
+
+  void *reallocate(void *ptr, size_t size) {
+    if (ptr == nullptr) {
+      return this->allocate(size);
+    }
+    Header *header = (Header *) ptr - 1;
+    size_t oldSize = header->size;
+    // stays on the heap of the pool
+    Header *resized = (Header *) realloc(header, sizeof(Header) + size);
+    if (resized == nullptr) {
+      // the other heap might still have room for it
+      void *moved = this->allocate(size);
+      if (moved != nullptr) {
+        memcpy(moved, ptr, oldSize < size ? oldSize : size);
+        this->deallocate(ptr);
+      }
+      return moved;
+    }
+    header = resized;
+    header->size = size;
+    HeapStats.remove(HeapTag::Json, oldSize);
+    HeapStats.add(HeapTag::Json, size);
+    return header + 1;
+  }
+};
+
+typedef BasicJsonDocument<IramJsonAllocator> IramJsonDocument;
+
+#endif
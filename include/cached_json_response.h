@@ -0,0 +1,75 @@
+#ifndef KEG_SCALE__CACHED_JSON_RESPONSE_H
+#define KEG_SCALE__CACHED_JSON_RESPONSE_H
+
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+
+#include "hash.h"
+
+// A JSON response serialized once and then served from memory with a strong ETag,
+// so that requests do not need to build any documents, and conditional requests
+// of clients with the same content are answered by 304 Not Modified.
+class CachedJsonResponse {
+
+private:
+  // A serialized document, freed once neither the cache nor any response reads from it.
+  struct SharedJson {
+    char *data;
+    size_t length;
+    uint32_t references;
+  };
+
+  SharedJson *json;
+  char etag[12];
+
+  static void release(SharedJson *json) {
+    if (--json->references == 0) {
+      delete[] json->data;
+      delete json;
+    }
+  }
+
+public:
+  CachedJsonResponse() : json(nullptr) {
+    this->etag[0] = 0;
+  }
+
+  bool isEmpty() {
+    return this->json == nullptr;
+  }
+
+  void update(JsonDocument &doc) {
+    size_t newLength = measureJson(doc);
+    char *newData = new char[newLength + 1];
+    serializeJson(doc, newData, newLength + 1);
+
+    if (this->json != nullptr) {
+      release(this->json);
+    }
+    this->json = new SharedJson{newData, newLength, 1};
+
+    snprintf(this->etag, sizeof(this->etag), "\"%08x\"", fnv1aHash(newData, newLength));
+  }
+
+  void send(AsyncWebServerRequest *request) {
+    AsyncWebServerResponse *response;
+    AsyncWebHeader *ifNoneMatch = request->getHeader("If-None-Match");
+    if (ifNoneMatch != nullptr && ifNoneMatch->value() == this->etag) {
+      response = request->beginResponse(304);
+    } else {
+      response = request->beginResponse_P(200, "application/json", (const uint8_t *) this->json->data, this->json->length);
+      // the response streams from the buffer until the connection closes, even after updates
+      SharedJson *json = this->json;
+      ++json->references;
+      request->onDisconnect([json]() {
+        release(json);
+      });
+    }
+    response->addHeader("ETag", this->etag);
+    // let clients cache it, but always revalidate
+    response->addHeader("Cache-Control", "no-cache");
+    request->send(response);
+  }
+};
+
+#endif
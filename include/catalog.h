@@ -3,19 +3,43 @@
 
 #include <ArduinoJson.h>
 #include <ESPDateTime.h>
+#include <LittleFS.h>
 #include <ESP8266HTTPClient.h>
+#include <ESP8266WiFi.h>
+#include <base64.h>
 #include <WiFiClientSecureBearSSL.h>
 #include <umm_malloc/umm_heap_select.h>
 #include <time.h>
 #include <vector>
 
+#include "clock.h"
 #include "config.h"
+#include "hash.h"
+#include "heap_stats.h"
 #include "logger.h"
-
-#define CATALOG_REFRESH_SECONDS   86400 // once a day - could be forced if needed anyways
-#define CATALOG_MAX_RESPONSE_SIZE 4096
-
-static const char *BREWFATHER_CATALOG_URL = "https://api.brewfather.app/v2/batches?status=Conditioning&include=batchNo,recipe.name,recipe.color,measuredBottlingSize,measuredFg,measuredAbv,bottlingDate";
+#include "metrics.h"
+
+#define CATALOG_REFRESH_SECONDS       86400 // once a day - could be forced if needed anyways
+#define CATALOG_RETRY_SECONDS         900
+#define CATALOG_RX_BUFFER_SIZE        4096
+#define CATALOG_ENTRY_JSON_SIZE       512
+#define CATALOG_FILTER_JSON_SIZE      256
+#define CATALOG_ENTRY_BUFFER_SIZE     1024 // raw JSON of a single batch in the response
+#define CATALOG_LINE_BUFFER_SIZE      128  // status line and headers, longer ones are truncated
+#define CATALOG_MAX_BYTES_PER_LOOP    512
+#define CATALOG_STEP_TIMEOUT_MILLIS   10000
+#define CATALOG_ETAG_SIZE             64
+#define CATALOG_PAGE_SIZE             25   // batches per request, the API allows up to 50
+#define CATALOG_MEMORY_BUDGET         8192 // for all entries, further batches are left out
+#define CATALOG_MAX_ENTRIES           (CATALOG_MEMORY_BUDGET / sizeof(CatalogEntry))
+
+#define CATALOG_CACHE_PATH            "/catalog.bin"
+#define CATALOG_CACHE_TEMP_PATH       "/catalog.tmp"
+#define CATALOG_CACHE_MAGIC           0x4b534243 // "CBSK"
+#define CATALOG_CACHE_VERSION         1
+
+static const char *BREWFATHER_CATALOG_HOST = "api.brewfather.app";
+static const char *BREWFATHER_CATALOG_PATH = "/v2/batches?status=Conditioning&include=batchNo,recipe.name,recipe.color,measuredBottlingSize,measuredFg,measuredAbv,bottlingDate";
 
 struct CatalogEntry {
   char id[32];
@@ -56,100 +80,170 @@ struct CatalogEntry {
   }
 };
 
+enum class CatalogRefreshState {
+  Idle,
+  Connecting,
+  Requesting,
+  ReadingHeaders,
+  ReadingBody
+};
+
+enum class ChunkState {
+  Size,
+  Data,
+  DataEnd,
+  Trailer
+};
+
+// Header of the catalog cache file, followed by the entries as they are in memory.
+struct CatalogCacheHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t entrySize;
+  uint32_t numEntries;
+  uint32_t contentHash;
+  time_t lastRefresh;
+  char etag[CATALOG_ETAG_SIZE];
+};
+
+// Fetches the catalog from Brewfather in small steps, one per loop, so that refreshes
+// do not stall the scales. The response is framed into single batches while reading,
+// and each of those is parsed into a CatalogEntry as soon as it is complete.
 class BrewfatherCatalog {
 
 private:
   BearSSL::WiFiClientSecure *client;
+  // resumes the TLS session of the previous connection, which avoids most of the handshake
+  BearSSL::Session session;
+  bool isMFLProbed;
   bool useMFL;
+  // of the TLS buffers, which are held from the connect until the client is stopped
+  size_t tlsBufferSize;
   int lastStatusCode;
   String lastErrorMessage;
 
   BrewfatherCatalogConfig *config;
   time_t lastRefresh;
+  time_t nextRefresh;
   std::vector<CatalogEntry> entries;
+  bool isTruncated;
+
+  StaticJsonDocument<CATALOG_FILTER_JSON_SIZE> filter;
+
+  bool isUpdateRequested;
+  CatalogRefreshState state;
+  uint32_t refreshStartMillis;
+  uint32_t stepStartMillis;
+  uint32_t bytesRead;
+
+  // the batches of the current page, merged into the entries once the page is complete
+  std::vector<CatalogEntry> parsedEntries;
+  // whether each of the entries was part of the current refresh, the others are removed at its end
+  std::vector<bool> isEntrySeen;
+  char startAfter[sizeof(CatalogEntry::id)];
+  uint8_t numPages;
+  size_t numEntriesParsed;
+
+  // where the time of a refresh goes, summed up over its requests
+  uint32_t connectStartMillis;
+  uint32_t requestStartMillis;
+  uint32_t handshakeMillis;
+  uint32_t transferMillis;
+  uint8_t numHandshakes;
+  uint8_t numRequests;
+  uint32_t lastHandshakeMillis;
+  uint32_t lastTransferMillis;
+
+  char lineBuffer[CATALOG_LINE_BUFFER_SIZE];
+  size_t lineLength;
+  int responseStatusCode;
+  char responseEtag[CATALOG_ETAG_SIZE];
+  uint32_t responseHash;
+
+  // HTTP/1.1 framing of the body, to know where it ends while keeping the connection alive
+  bool isConnectionReusable;
+  bool isChunked;
+  int32_t bodyRemaining; // -1 when the length is unknown, so the body ends with the connection
+  ChunkState chunkState;
+  uint32_t chunkRemaining;
+  bool isChunkExtension;
+  uint16_t trailerLineLength;
+  bool isBodyDone;
+
+  // identify the content of the cached entries, so that unchanged responses keep them as they are
+  char etag[CATALOG_ETAG_SIZE];
+  uint32_t contentHash;
+
+  // frames the batches of the response array, see consume()
+  char *entryBuffer;
+  size_t entryLength;
+  uint8_t depth;
+  bool isInString;
+  bool isEscaped;
+  bool isArrayStarted;
+  bool isArrayDone;
+
+  void setState(CatalogRefreshState newState);
+  void startRefresh();
+  void startRequest();
+  void finishResponse();
+  void mergePage();
+  void removeUnseenEntries();
+  void updateHeapStats();
+  void finishRefresh(bool isSuccess);
+  void failRefresh(int statusCode, const char *message);
+
+  void connect();
+  void sendRequest();
+  void readHeaders();
+  void readBody();
+
+  bool readLine();
+  void parseHeader();
+  size_t getMaxBodyRead();
+  bool consumeBody(char c);
+  bool consumePayload(char c);
+  bool consume(char c);
+  bool parseEntry();
+
+  void loadCache();
+  void saveCache();
 
 public:
-  void begin(BrewfatherCatalogConfig *_config, BearSSL::WiFiClientSecure *_client) {
-    this->config = _config;
-    this->client = _client;
-    {
-      HeapSelectIram ephemeral;
-      this->useMFL = this->client->probeMaxFragmentLength(BREWFATHER_CATALOG_URL, 443, 512);
-      Serial.printf("Brewfather catalog:%s using MFLN.\n", this->useMFL ? "" : " NOT");
-    }
-    this->lastStatusCode = 0;
-    this->lastErrorMessage = String("");
-    this->lastRefresh = 0;
-    this->entries.clear();
+  BrewfatherCatalog();
+
+  void begin(BrewfatherCatalogConfig *_config, BearSSL::WiFiClientSecure *_client);
+  void update();
+  void handle();
+
+  CatalogRefreshState getRefreshState() {
+    return this->state;
+  }
+
+  const char *getRefreshStateName();
+
+  uint32_t getRefreshBytesRead() {
+    return this->bytesRead;
+  }
+
+  size_t getRefreshEntriesParsed() {
+    return this->numEntriesParsed;
+  }
+
+  uint8_t getRefreshPages() {
+    return this->numPages;
+  }
+
+  bool getIsTruncated() {
+    return this->isTruncated;
   }
 
-  void update() {
-    // the next update will execute in the loop
-    this->lastRefresh = 0;
+  uint32_t getLastHandshakeMillis() {
+    return this->lastHandshakeMillis;
   }
 
-  void handle() {
-    HeapSelectIram ephemeral;
-
-    time_t now = DateTime.now();
-    time_t elapsed = now - this->lastRefresh;
-    if (elapsed < CATALOG_REFRESH_SECONDS) {
-      return;
-    }
-
-    Logger.printWithFreeHeaps("[BrewfatherCatalog] Update started");
-
-    this->client->setBufferSizes(this->useMFL ? CATALOG_MAX_RESPONSE_SIZE : 512, 512);
-
-    HTTPClient https;
-
-    if (https.begin(*client, BREWFATHER_CATALOG_URL)) {
-      https.setAuthorization(this->config->userId, this->config->apiKey);
-      this->lastStatusCode = https.GET();
-
-      if (this->lastStatusCode > 0) {
-        this->lastErrorMessage = String("");
-
-        if (this->lastStatusCode == HTTP_CODE_OK || this->lastStatusCode == HTTP_CODE_MOVED_PERMANENTLY) {
-          String payload = https.getString();
-          DynamicJsonDocument doc(CATALOG_MAX_RESPONSE_SIZE);
-          DeserializationError error = deserializeJson(doc, payload);
-
-          if (error) {
-            this->lastErrorMessage = String(error.c_str());
-          } else {
-            JsonArray entriesToParse = doc.as<JsonArray>();
-            this->entries.clear();
-
-            Logger.printWithFreeHeaps("[BrewfatherCatalog] Update in progress");
-
-            uint8_t numEntries = entriesToParse.size();
-            for (int i = 0; i < numEntries; ++i) {
-              CatalogEntry currentEntry;
-              strlcpy(currentEntry.id, entriesToParse[i]["_id"], sizeof(currentEntry.id));
-              currentEntry.number = entriesToParse[i]["batchNo"];
-              strlcpy(currentEntry.name, entriesToParse[i]["recipe"]["name"], sizeof(currentEntry.name));
-              currentEntry.bottlingDate = (int)(entriesToParse[i]["bottlingDate"].as<double>() / 1000l);
-              currentEntry.bottlingVolume = entriesToParse[i]["measuredBottlingSize"];
-              currentEntry.finalGravity = entriesToParse[i]["measuredFg"].as<float>() * 1000.0;
-              currentEntry.abv = entriesToParse[i]["measuredAbv"];
-              currentEntry.srm = entriesToParse[i]["recipe"]["color"];
-              this->entries.push_back(currentEntry);
-            }
-
-            this->lastRefresh = now;
-          }
-        }
-      } else {
-        this->lastErrorMessage = https.errorToString(this->lastStatusCode);
-      }
-
-      https.end();
-    } else {
-      this->lastErrorMessage = String("Unable to connect to the target host.");
-    }
-
-    Logger.printWithFreeHeaps("[BrewfatherCatalog] Update done");
+  uint32_t getLastTransferMillis() {
+    return this->lastTransferMillis;
   }
 
   time_t getLastRefresh() {
@@ -0,0 +1,95 @@
+#ifndef KEG_SCALE__CLOCK_H
+#define KEG_SCALE__CLOCK_H
+
+#include <Arduino.h>
+
+#include "rtc_memory.h"
+
+#define CLOCK_RTC_MAGIC                0x4b53434b
+#define CLOCK_RTC_SAVE_INTERVAL_MILLIS 60000
+// a reset takes seconds, and the time is saved every minute, so a longer gap means a restarted counter
+#define CLOCK_MAX_RESTORE_GAP_SECONDS  600
+#define CLOCK_NTP_SERVER               "pool.ntp.org"
+
+// Wall time at a reading of the RTC counter, which keeps counting through resets.
+struct ClockRtcData {
+  uint32_t magic;
+  uint32_t rtcTime;
+  // microseconds per RTC tick, in Q12 fixed point
+  uint32_t rtcCalibration;
+  uint32_t epochSeconds;
+};
+
+static_assert(sizeof(ClockRtcData) <= (RTC_MEMORY_SIZE - RTC_MEMORY_CLOCK_OFFSET) * 4, "Clock data does not fit into the RTC user memory.");
+
+// Monotonic time since boot, and the wall time derived from it. The wall time is the monotonic
+// time plus an offset, which is set when the time is restored from the RTC memory after a reset,
+// and corrected whenever NTP synchronizes, which may step the wall time back. Users needing
+// ordered timestamps, like the recorder, keep them ordered themselves.
+// The time is restored at boot, and NTP confirms it in the background once the network is up.
+class ClockClass {
+
+private:
+  uint32_t lastMillis;
+  uint32_t millisWraps;
+  // wall time minus monotonic time, zero while the wall time is unknown
+  int64_t epochOffsetMillis;
+
+  bool isRestored;
+  bool isSynced;
+  volatile bool isSyncPending;
+  uint32_t lastSaveMillis;
+
+  void setWallTimeMillis(int64_t wallTimeMillis);
+  void save();
+
+public:
+  ClockClass()
+    : lastMillis(0)
+    , millisWraps(0)
+    , epochOffsetMillis(0)
+    , isRestored(false)
+    , isSynced(false)
+    , isSyncPending(false)
+    , lastSaveMillis(0) {};
+
+  // restores the time saved before the reset, if there is one
+  void begin();
+  // starts NTP without waiting for it, its result is applied from the loop
+  void startSync();
+  void handle();
+
+  // milliseconds since boot, without the wrap of millis() after 49 days
+  uint64_t monotonicMillis() {
+    uint32_t currentMillis = millis();
+    if (currentMillis < this->lastMillis) {
+      ++this->millisWraps;
+    }
+    this->lastMillis = currentMillis;
+    return ((uint64_t) this->millisWraps << 32) | currentMillis;
+  }
+
+  bool isValid() {
+    return this->epochOffsetMillis != 0;
+  }
+
+  // wall time in seconds, or zero while unknown
+  time_t now() {
+    if (!this->isValid()) {
+      return 0;
+    }
+    return (time_t) ((this->epochOffsetMillis + (int64_t) this->monotonicMillis()) / 1000);
+  }
+
+  bool getIsRestored() {
+    return this->isRestored;
+  }
+
+  bool getIsSynced() {
+    return this->isSynced;
+  }
+};
+
+extern ClockClass Clock;
+
+#endif
@@ -6,6 +6,17 @@
 #include <LittleFS.h>
 #include <vector>
 
+#define CONFIG_PATH              "/config.json"
+#define CONFIG_CACHE_PATH        "/config.bin"
+#define CONFIG_CACHE_TEMP_PATH   "/config.bin.tmp"
+#define CONFIG_CACHE_MAGIC       0x4b534343
+#define CONFIG_CACHE_VERSION     2 // images of version 1 may hold arrays found by a text search
+#define CONFIG_CACHE_MAX_SIZE    8192
+#define CONFIG_HASH_BUFFER_SIZE  256
+// the document of the top level settings, and of each array element separately
+#define CONFIG_ELEMENT_JSON_SIZE 512
+#define CONFIG_FILTER_JSON_SIZE  128
+
 struct WiFiConfig {
   char ssid[64];
   char passphrase[64];
@@ -59,8 +70,33 @@ struct CatalogConfig {
   BrewfatherCatalogConfig brewfather;
 };
 
+// Binary image of the parsed configuration, followed by its arrays. It is only valid
+// for the config.json it was compiled from, which is told by the hash of the source.
+struct ConfigCacheHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t numWifis;
+  uint16_t numScales;
+  uint16_t numWeights;
+  uint32_t sourceHash;
+  uint32_t sourceSize;
+  // catches layout changes of the records without bumping the version
+  uint16_t wifiSize;
+  uint16_t scaleSize;
+  uint16_t weightSize;
+  char hostname[64];
+  uint16_t httpPort;
+  CatalogConfig catalog;
+  OTAConfig ota;
+};
+
 class Config {
 
+private:
+  bool parse(File &file);
+  bool loadCache(uint32_t sourceHash, uint32_t sourceSize);
+  void saveCache(uint32_t sourceHash, uint32_t sourceSize);
+
 public:
   char hostname[64];
   uint16_t httpPort;
@@ -71,69 +107,8 @@ public:
   std::vector<Weight> weights;
   char fsLastModified[32];
 
-  bool load() {
-    File configFile = LittleFS.open("/config.json", "r");
-    if (!configFile) {
-      return false;
-    }
-
-    DynamicJsonDocument doc(2048);
-    DeserializationError error = deserializeJson(doc, configFile);
-    if (error) {
-      return false;
-    }
-
-    strlcpy(this->hostname, doc["hostname"] | "keg-scale", sizeof(this->hostname));
-    this->httpPort = doc["httpPort"] | 80;
-
-    uint8_t numWifis = doc["wifis"].size() | 0;
-    for (int i = 0; i < numWifis; ++i) {
-      WiFiConfig currentWifi;
-      strlcpy(currentWifi.ssid, doc["wifis"][i]["ssid"], sizeof(currentWifi.ssid));
-      strlcpy(currentWifi.passphrase, doc["wifis"][i]["passphrase"], sizeof(currentWifi.passphrase));
-      this->wifis.push_back(currentWifi);
-    }
-
-    strlcpy(this->catalog.brewfather.userId, doc["catalog"]["brewfather"]["userId"] | "", sizeof(this->catalog.brewfather.userId));
-    strlcpy(this->catalog.brewfather.apiKey, doc["catalog"]["brewfather"]["apiKey"] | "", sizeof(this->catalog.brewfather.apiKey));
-
-    this->ota.port = doc["ota"]["port"] | 8266;
-    strlcpy(this->ota.password, doc["ota"]["password"] | "", sizeof(this->ota.password));
-
-    uint8_t numScales = doc["scales"].size() | 0;
-    for (int i = 0; i < numScales; ++i) {
-      ScaleConfig currentScale;
-      strlcpy(currentScale.label, doc["scales"][i]["label"] | (String("Scale ") + String(i)).c_str(), sizeof(currentScale.label));
-      currentScale.clockPin = doc["scales"][i]["clockPin"];
-      currentScale.dataPin = doc["scales"][i]["dataPin"];
-      currentScale.gain = doc["scales"][i]["gain"] | 128;
-      currentScale.reverse = doc["scales"][i]["reverse"] | false;
-      currentScale.initMillis = doc["scales"][i]["initMillis"] | 5000;
-      currentScale.initTare = doc["scales"][i]["initTare"] | false;
-      this->scales.push_back(currentScale);
-    }
-
-    uint8_t numWeights = doc["weights"].size() | 0;
-    for (int i = 0; i < numWeights; ++i) {
-      Weight currentWeight;
-      strlcpy(currentWeight.label, doc["weights"][i]["label"], sizeof(currentWeight.label));
-      currentWeight.mass = doc["weights"][i]["mass"];
-      currentWeight.forTare = doc["weights"][i]["forTare"] | false;
-      currentWeight.forCalibration = doc["weights"][i]["forCalibration"] | false;
-      this->weights.push_back(currentWeight);
-    }
-
-    configFile.close();
-
-    File stampFile = LittleFS.open("/stamp", "r");
-    if (!stampFile) {
-      return false;
-    }
-    strlcpy(this->fsLastModified, stampFile.readString().c_str(), sizeof(this->fsLastModified));
-    stampFile.close();
-
-    return true;
-  }
+  // Loads the compiled image of /config.json, which is parsed and compiled again only after it changed.
+  bool load();
 
   void render(JsonDocument &doc) {
     JsonArray jsc = doc.createNestedArray("scales");
@@ -0,0 +1,93 @@
+#ifndef KEG_SCALE__CRASH_TRACE_H
+#define KEG_SCALE__CRASH_TRACE_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <stddef.h>
+
+#include "rtc_memory.h"
+
+#define CRASH_TRACE_RTC_OFFSET      RTC_MEMORY_CRASH_TRACE_OFFSET
+#define CRASH_TRACE_RTC_SIZE        ((RTC_MEMORY_CLOCK_OFFSET - RTC_MEMORY_CRASH_TRACE_OFFSET) * 4)
+#define CRASH_TRACE_MAGIC           0x4b534354
+#define CRASH_TRACE_NUM_EVENTS      5
+#define CRASH_TRACE_EVENT_TEXT_SIZE 39
+#define CRASH_TRACE_MAX_SCALES      4
+#define CRASH_TRACE_STATE_NAME_SIZE 16
+
+enum class TracedPhase : uint32_t {
+  Setup,
+  Network,
+  Ota,
+  Catalog,
+  Scales,
+  Logger,
+  // between two loops, when the core and the async server callbacks run
+  System,
+  Count
+};
+
+struct CrashTraceEvent {
+  uint32_t millis;
+  uint8_t level;
+  char text[CRASH_TRACE_EVENT_TEXT_SIZE];
+};
+
+struct CrashTraceScale {
+  char stateName[CRASH_TRACE_STATE_NAME_SIZE];
+  uint32_t recordingId;
+  uint32_t recordingValue;
+};
+
+// Layout of the trace in the RTC user memory. Only the changed fields are written,
+// so the trace is kept up to date all the time, without a copy in RAM.
+struct CrashTraceData {
+  uint32_t magic;
+  uint32_t phaseMillis;
+  TracedPhase phase;
+  uint32_t numEvents;
+  CrashTraceScale scales[CRASH_TRACE_MAX_SCALES];
+  CrashTraceEvent events[CRASH_TRACE_NUM_EVENTS];
+};
+
+static_assert(sizeof(CrashTraceData) <= CRASH_TRACE_RTC_SIZE, "Crash trace does not fit into the RTC user memory.");
+
+// Keeps the last log lines, the current loop phase and the state of each scale
+// in the RTC user memory, which survives every reset except a power loss.
+// On boot, the trace of the previous run is kept for /status/last-crash.
+class CrashTraceClass {
+
+private:
+  bool isStarted;
+  uint32_t numEvents;
+  // the trace of the previous run, if there was one
+  CrashTraceData *lastTrace;
+
+  void write(size_t offset, const void *data, size_t size) {
+    ESP.rtcUserMemoryWrite(CRASH_TRACE_RTC_OFFSET + offset / 4, (uint32_t *) data, size);
+  }
+
+public:
+  CrashTraceClass() : isStarted(false), numEvents(0), lastTrace(nullptr) {};
+
+  // called first on boot, before anything is recorded
+  void begin();
+
+  void setPhase(TracedPhase phase) {
+    if (!this->isStarted) {
+      return;
+    }
+    uint32_t words[2] = {(uint32_t) millis(), (uint32_t) phase};
+    this->write(offsetof(CrashTraceData, phaseMillis), words, sizeof(words));
+  }
+
+  void recordLog(uint8_t level, const char *text, size_t len);
+  void recordScaleState(int index, const char *stateName);
+  void recordRecorderCursor(int index, uint32_t recordingId, uint32_t recordingValue);
+
+  void render(JsonDocument &doc) const;
+};
+
+extern CrashTraceClass CrashTrace;
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef KEG_SCALE__HASH_H
+#define KEG_SCALE__HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FNV1A_INITIAL_HASH 2166136261u
+#define FNV1A_PRIME        16777619u
+
+// 32-bit FNV-1a, which can be continued over multiple chunks by passing the previous result.
+inline uint32_t fnv1aHash(const void *data, size_t length, uint32_t hash = FNV1A_INITIAL_HASH) {
+  const uint8_t *bytes = (const uint8_t *) data;
+  for (size_t i = 0; i < length; ++i) {
+    hash = (hash ^ bytes[i]) * FNV1A_PRIME;
+  }
+  return hash;
+}
+
+#endif
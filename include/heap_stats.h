@@ -0,0 +1,82 @@
+#ifndef KEG_SCALE__HEAP_STATS_H
+#define KEG_SCALE__HEAP_STATS_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+
+#define HEAP_STATS_MAX_TRACKED_BUFFERS 16
+
+enum class HeapTag : uint8_t {
+  Recorder,
+  WebSocket,
+  Catalog,
+  Json,
+  WebRequests,
+  Count
+};
+
+// Bytes held on the heaps by each subsystem, as they report them when allocating and
+// freeing, along with the peaks of them and the lowest free heaps seen since boot.
+// Only counters are updated, so that it is cheap enough to be always on.
+class HeapStatsClass {
+
+private:
+  uint32_t currentBytes[(size_t) HeapTag::Count];
+  uint32_t peakBytes[(size_t) HeapTag::Count];
+  uint32_t minFreeDramHeap;
+  uint32_t minFreeIramHeap;
+
+  // message buffers are freed by the web socket library, which is noticed by holding a reference to them
+  AsyncWebSocketMessageBuffer *buffers[HEAP_STATS_MAX_TRACKED_BUFFERS];
+  size_t numBuffers;
+  uint32_t numUntrackedBuffers;
+
+  void sampleFreeHeaps();
+
+public:
+  HeapStatsClass()
+    : currentBytes{}
+    , peakBytes{}
+    , minFreeDramHeap(UINT32_MAX)
+    , minFreeIramHeap(UINT32_MAX)
+    , buffers{}
+    , numBuffers(0)
+    , numUntrackedBuffers(0) {};
+
+  void add(HeapTag tag, size_t bytes) {
+    uint32_t &current = this->currentBytes[(size_t) tag];
+    current += bytes;
+    if (current > this->peakBytes[(size_t) tag]) {
+      this->peakBytes[(size_t) tag] = current;
+    }
+  }
+
+  void remove(HeapTag tag, size_t bytes) {
+    uint32_t &current = this->currentBytes[(size_t) tag];
+    current = bytes < current ? current - bytes : 0;
+  }
+
+  // for subsystems which know their whole footprint better than each allocation
+  void set(HeapTag tag, size_t bytes) {
+    this->currentBytes[(size_t) tag] = 0;
+    this->add(tag, bytes);
+  }
+
+  // Makes a message buffer, which is accounted until the library releases it. Short lived buffers
+  // prefer the small IRAM heap, long lived ones and those not fitting there use the DRAM heap.
+  // Gives nullptr when neither heap has room for it.
+  AsyncWebSocketMessageBuffer *makeBuffer(AsyncWebSocket &socket, size_t len, bool isLongLived = false);
+
+  // releases the message buffers which are not used anymore, and samples the free heaps
+  void handle();
+
+  // renders the bytes by their tags
+  void render(JsonObject obj) const;
+  // adds the lowest free heaps to the other heap stats
+  void renderFreeHeaps(JsonObject heap) const;
+};
+
+extern HeapStatsClass HeapStats;
+
+#endif
@@ -0,0 +1,293 @@
+#ifndef KEG_SCALE__JSON_WRITER_H
+#define KEG_SCALE__JSON_WRITER_H
+
+#include <cmath>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <type_traits>
+
+// Streaming JSON serializer that writes directly into a preallocated buffer,
+// without building any intermediate document. Without a buffer it only counts
+// the bytes, which allows to allocate the exact size before the actual write.
+// Values are formatted the same way as ArduinoJson serializes them, so replacing
+// a document based render keeps the output the same byte for byte.
+class JsonWriter {
+
+private:
+  char *buffer;
+  size_t capacity;
+  size_t length;
+  uint32_t hasMembers; // one bit per nesting level
+  uint8_t depth;
+
+  void writeRaw(char c) {
+    if (this->buffer != nullptr && this->length < this->capacity) {
+      this->buffer[this->length] = c;
+    }
+    ++this->length;
+  }
+
+  void writeRaw(const char *begin, const char *end) {
+    while (begin < end) {
+      this->writeRaw(*begin++);
+    }
+  }
+
+  void writeRaw(const char *s) {
+    while (*s) {
+      this->writeRaw(*s++);
+    }
+  }
+
+  void writeString(const char *s) {
+    this->writeRaw('"');
+    for (; *s; ++s) {
+      char escaped = 0;
+      switch (*s) {
+        case '"': escaped = '"'; break;
+        case '\\': escaped = '\\'; break;
+        case '\b': escaped = 'b'; break;
+        case '\f': escaped = 'f'; break;
+        case '\n': escaped = 'n'; break;
+        case '\r': escaped = 'r'; break;
+        case '\t': escaped = 't'; break;
+      }
+      if (escaped) {
+        this->writeRaw('\\');
+        this->writeRaw(escaped);
+      } else {
+        this->writeRaw(*s);
+      }
+    }
+    this->writeRaw('"');
+  }
+
+  template<typename T>
+  void writeInteger(T value) {
+    typedef typename std::make_unsigned<T>::type U;
+    U digitsToWrite = (U) value;
+    if (std::is_signed<T>::value && value < 0) {
+      this->writeRaw('-');
+      digitsToWrite = (U) (0 - digitsToWrite);
+    }
+
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *begin = end;
+    do {
+      *--begin = (char) ('0' + digitsToWrite % 10);
+      digitsToWrite /= 10;
+    } while (digitsToWrite != 0);
+    this->writeRaw(begin, end);
+  }
+
+  // Powers of ten used to normalize values into scientific notation,
+  // indexed by the binary exponent (i.e. 1e1, 1e2, 1e4, 1e8, ...).
+  static double positiveBinaryPowerOfTen(int index) {
+    static const double factors[] = {1e1, 1e2, 1e4, 1e8, 1e16, 1e32, 1e64, 1e128, 1e256};
+    return factors[index];
+  }
+
+  static double negativeBinaryPowerOfTen(int index) {
+    static const double factors[] = {1e-1, 1e-2, 1e-4, 1e-8, 1e-16, 1e-32, 1e-64, 1e-128, 1e-256};
+    return factors[index];
+  }
+
+  static double negativeBinaryPowerOfTenPlusOne(int index) {
+    static const double factors[] = {1e0, 1e-1, 1e-3, 1e-7, 1e-15, 1e-31, 1e-63, 1e-127, 1e-255};
+    return factors[index];
+  }
+
+  static int16_t normalizeFloat(double &value) {
+    int16_t powersOf10 = 0;
+    int8_t index = 8;
+    int bit = 1 << index;
+
+    if (value >= 1e7) {
+      for (; index >= 0; --index) {
+        if (value >= positiveBinaryPowerOfTen(index)) {
+          value *= negativeBinaryPowerOfTen(index);
+          powersOf10 = (int16_t) (powersOf10 + bit);
+        }
+        bit >>= 1;
+      }
+    }
+
+    if (value > 0 && value <= 1e-5) {
+      for (; index >= 0; --index) {
+        if (value < negativeBinaryPowerOfTenPlusOne(index)) {
+          value *= positiveBinaryPowerOfTen(index);
+          powersOf10 = (int16_t) (powersOf10 - bit);
+        }
+        bit >>= 1;
+      }
+    }
+
+    return powersOf10;
+  }
+
+  // Same algorithm as ArduinoJson uses for doubles: up to 9 significant decimals,
+  // trailing zeros removed and exponents outside of the [1e-5, 1e7) range.
+  void writeFloat(double value) {
+    if (std::isnan(value) || std::isinf(value)) {
+      this->writeRaw("null");
+      return;
+    }
+
+    if (value < 0.0) {
+      this->writeRaw('-');
+      value = -value;
+    }
+
+    uint32_t maxDecimalPart = 1000000000;
+    int8_t decimalPlaces = 9;
+    int16_t exponent = normalizeFloat(value);
+
+    uint32_t integral = (uint32_t) value;
+    for (uint32_t tmp = integral; tmp >= 10; tmp /= 10) {
+      maxDecimalPart /= 10;
+      --decimalPlaces;
+    }
+
+    double remainder = (value - (double) integral) * (double) maxDecimalPart;
+    uint32_t decimal = (uint32_t) remainder;
+    remainder = remainder - (double) decimal;
+
+    // round up when the remainder is at least 0.5
+    decimal += (uint32_t) (remainder * 2);
+    if (decimal >= maxDecimalPart) {
+      decimal = 0;
+      ++integral;
+      if (exponent && integral >= 10) {
+        ++exponent;
+        integral = 1;
+      }
+    }
+
+    while (decimal % 10 == 0 && decimalPlaces > 0) {
+      decimal /= 10;
+      --decimalPlaces;
+    }
+
+    this->writeInteger(integral);
+    if (decimalPlaces > 0) {
+      char digits[16];
+      char *end = digits + sizeof(digits);
+      char *begin = end;
+      while (decimalPlaces--) {
+        *--begin = (char) ('0' + decimal % 10);
+        decimal /= 10;
+      }
+      *--begin = '.';
+      this->writeRaw(begin, end);
+    }
+    if (exponent) {
+      this->writeRaw('e');
+      this->writeInteger(exponent);
+    }
+  }
+
+  void writeKey(const char *key) {
+    uint32_t bit = 1ul << this->depth;
+    if (this->hasMembers & bit) {
+      this->writeRaw(',');
+    }
+    this->hasMembers |= bit;
+    this->writeString(key);
+    this->writeRaw(':');
+  }
+
+  void openObject() {
+    this->writeRaw('{');
+    ++this->depth;
+    this->hasMembers &= ~(1ul << this->depth);
+  }
+
+public:
+  // measures the output only
+  JsonWriter() : JsonWriter(nullptr, 0) {};
+
+  JsonWriter(char *_buffer, size_t _capacity)
+    : buffer(_buffer)
+    , capacity(_capacity)
+    , length(0)
+    , hasMembers(0)
+    , depth(0) {};
+
+  void beginObject() {
+    this->openObject();
+  }
+
+  void beginObject(const char *key) {
+    this->writeKey(key);
+    this->openObject();
+  }
+
+  void endObject() {
+    this->writeRaw('}');
+    --this->depth;
+    if (this->depth == 0 && this->buffer != nullptr && this->length < this->capacity) {
+      // terminate without counting it, just like serializeJson() does
+      this->buffer[this->length] = 0;
+    }
+  }
+
+  void member(const char *key, const char *value) {
+    this->writeKey(key);
+    this->writeString(value);
+  }
+
+  void member(const char *key, bool value) {
+    this->writeKey(key);
+    this->writeRaw(value ? "true" : "false");
+  }
+
+  void member(const char *key, double value) {
+    this->writeKey(key);
+    this->writeFloat(value);
+  }
+
+  template<typename T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, int>::type = 0>
+  void member(const char *key, T value) {
+    this->writeKey(key);
+    this->writeInteger(value);
+  }
+
+  // Integer keys are used for the timestamps of recorded data points.
+  template<typename T>
+  void member(time_t key, T value) {
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *begin = end;
+    *--begin = 0;
+    time_t rest = key < 0 ? -key : key;
+    do {
+      *--begin = (char) ('0' + rest % 10);
+      rest /= 10;
+    } while (rest != 0);
+    if (key < 0) {
+      *--begin = '-';
+    }
+    this->member((const char *) begin, value);
+  }
+
+  // Same as rendering DateFormatter::format(format, value), but without allocating a String.
+  void memberTime(const char *key, const char *format, time_t value) {
+    struct tm tm;
+    char formatted[32];
+    gmtime_r(&value, &tm);
+    strftime(formatted, sizeof(formatted), format, &tm);
+    this->member(key, (const char *) formatted);
+  }
+
+  size_t size() const {
+    return this->length;
+  }
+
+  bool isOverflowed() const {
+    return this->buffer != nullptr && this->length > this->capacity;
+  }
+};
+
+#endif
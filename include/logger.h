@@ -4,38 +4,92 @@
 #include <ESPAsyncWebServer.h>
 #include <umm_malloc/umm_heap_select.h>
 
+#define LOG_LEVEL_ERROR   0
+#define LOG_LEVEL_WARNING 1
+#define LOG_LEVEL_INFO    2
+#define LOG_LEVEL_DEBUG   3
+
+// messages above this level are compiled out, the runtime level can only lower it further
+#define LOG_COMPILED_LEVEL LOG_LEVEL_DEBUG
+#define LOG_DEFAULT_LEVEL  LOG_LEVEL_INFO
+
+#define LOG_BUFFER_SIZE           2048
+#define LOG_LINE_SIZE             160
+#define LOG_FLUSH_INTERVAL_MILLIS 250
+
+#if LOG_COMPILED_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) Logger.log(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...)
+#endif
+
+#if LOG_COMPILED_LEVEL >= LOG_LEVEL_WARNING
+#define LOG_WARNING(...) Logger.log(LOG_LEVEL_WARNING, __VA_ARGS__)
+#else
+#define LOG_WARNING(...)
+#endif
+
+#if LOG_COMPILED_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) Logger.log(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...)
+#endif
+
+#if LOG_COMPILED_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) Logger.log(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...)
+#endif
+
+// Assembles the printed output into lines, and keeps the most recent ones in a ring buffer.
+// The lines are sent to the clients of /log in batches, at most once per flush interval,
+// and new clients get the whole buffer first, so they also see what was logged before.
 class LoggerClass : public Print {
 
 private:
   AsyncWebSocket logSocket;
+  uint8_t level;
+
+  char line[LOG_LINE_SIZE];
+  size_t lineLength;
+  uint8_t lineLevel;
+  uint32_t lineStartMillis;
+
+  // positions only ever grow, and are mapped into the buffer modulo its size
+  char buffer[LOG_BUFFER_SIZE];
+  uint32_t head;
+  uint32_t tail;
+  uint32_t flushed;
+  uint32_t lastFlushMillis;
+  uint32_t droppedLines;
+
+  void commitLine();
+  AsyncWebSocketMessageBuffer *makeMessage(uint32_t from, uint32_t to);
+  void flush();
 
 public:
-  LoggerClass() : logSocket("/log") {
-    this->logSocket.onEvent([this](AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
-      if (type == WS_EVT_CONNECT) {
-        client->text("Logging started.");
-      }
-    });
-  }
+  LoggerClass();
 
-  void handle() {
-    this->logSocket.cleanupClients();
-  }
+  void handle();
 
   AsyncWebSocket* getSocket() {
     return &this->logSocket;
   }
 
-  size_t write(uint8_t b) override {
-    this->logSocket.binaryAll(&b, 1);
-    return 1;
+  uint8_t getLevel() {
+    return this->level;
   }
 
-  size_t write(const uint8_t *buffer, size_t len) override {
-    this->logSocket.textAll((const char *) buffer, len);
-    return len;
+  void setLevel(uint8_t _level) {
+    this->level = _level;
   }
 
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t *buffer, size_t len) override;
+
+  // prints a single line with the given level, which is dropped when above the runtime level
+  void log(uint8_t messageLevel, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
   void printWithFreeHeaps(const char* message) {
     uint32_t freeDramHeap;
     uint32_t freeIramHeap;
@@ -0,0 +1,97 @@
+#ifndef KEG_SCALE__METRICS_H
+#define KEG_SCALE__METRICS_H
+
+#include <Arduino.h>
+#include <vector>
+
+struct ScaleMetrics {
+  uint32_t adcSamples;
+  uint32_t signalTimeouts;
+  uint32_t stateTransitions;
+  uint32_t recordedPoints;
+};
+
+// Counters of the whole firmware, incremented in place by the subsystems and
+// printed in the Prometheus text format on /metrics. Rates like the samples
+// per second are derived by the scraper, e.g. rate(keg_scale_adc_samples_total[1m]).
+class MetricsClass {
+
+private:
+  std::vector<ScaleMetrics> scales;
+  ScaleMetrics unknownScale;
+
+public:
+  uint32_t websocketFramesSent;
+  uint32_t websocketFramesDropped;
+
+  uint32_t catalogFetches;
+  uint32_t catalogFetchFailures;
+  uint32_t lastCatalogFetchMillis;
+  uint32_t lastCatalogHandshakeMillis;
+
+  MetricsClass()
+    : unknownScale{}
+    , websocketFramesSent(0)
+    , websocketFramesDropped(0)
+    , catalogFetches(0)
+    , catalogFetchFailures(0)
+    , lastCatalogFetchMillis(0)
+    , lastCatalogHandshakeMillis(0) {};
+
+  void begin(size_t numScales) {
+    this->scales.assign(numScales, ScaleMetrics{});
+  }
+
+  ScaleMetrics &forScale(size_t index) {
+    // counting into a scratch entry keeps callers free of bounds checks
+    return index < this->scales.size() ? this->scales[index] : this->unknownScale;
+  }
+
+  void recordCatalogFetch(uint32_t elapsedMillis, uint32_t handshakeMillis, bool isSuccess) {
+    ++this->catalogFetches;
+    if (!isSuccess) {
+      ++this->catalogFetchFailures;
+    }
+    this->lastCatalogFetchMillis = elapsedMillis;
+    this->lastCatalogHandshakeMillis = handshakeMillis;
+  }
+
+  static void printHeader(Print &out, const char *name, const char *type, const char *help) {
+    out.printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+  }
+
+  static void printValue(Print &out, const char *name, uint32_t value) {
+    out.printf("%s %u\n", name, value);
+  }
+
+  static void printMetric(Print &out, const char *name, const char *type, const char *help, uint32_t value) {
+    printHeader(out, name, type, help);
+    printValue(out, name, value);
+  }
+
+  void printScaleMetric(Print &out, const char *name, const char *type, const char *help, uint32_t ScaleMetrics::*counter) {
+    printHeader(out, name, type, help);
+    for (size_t i = 0; i < this->scales.size(); ++i) {
+      out.printf("%s{scale=\"%u\"} %u\n", name, (unsigned int) i, this->scales[i].*counter);
+    }
+  }
+
+  void render(Print &out) {
+    this->printScaleMetric(out, "keg_scale_adc_samples_total", "counter", "ADC conversions read.", &ScaleMetrics::adcSamples);
+    this->printScaleMetric(out, "keg_scale_signal_timeouts_total", "counter", "Times the ADC went offline due to a signal timeout.", &ScaleMetrics::signalTimeouts);
+    this->printScaleMetric(out, "keg_scale_state_transitions_total", "counter", "Scale state changes.", &ScaleMetrics::stateTransitions);
+    this->printScaleMetric(out, "keg_scale_recorded_points_total", "counter", "Points added to recordings.", &ScaleMetrics::recordedPoints);
+
+    printMetric(out, "keg_scale_websocket_frames_sent_total", "counter", "Scale data frames queued for clients.", this->websocketFramesSent);
+    printMetric(out, "keg_scale_websocket_frames_dropped_total", "counter", "Scale data frames dropped due to full client queues.", this->websocketFramesDropped);
+
+    printMetric(out, "keg_scale_catalog_fetches_total", "counter", "Catalog fetches.", this->catalogFetches);
+    printMetric(out, "keg_scale_catalog_fetch_failures_total", "counter", "Failed catalog fetches.", this->catalogFetchFailures);
+    printMetric(out, "keg_scale_catalog_last_fetch_milliseconds", "gauge", "Duration of the last catalog fetch.", this->lastCatalogFetchMillis);
+    printMetric(out, "keg_scale_catalog_last_handshake_milliseconds", "gauge", "Time spent on TLS handshakes in the last catalog fetch.", this->lastCatalogHandshakeMillis);
+  }
+};
+
+extern MetricsClass Metrics;
+
+#endif
@@ -1,10 +1,22 @@
 #ifndef KEG_SCALE__PERSISTENT_CONFIG_H
 #define KEG_SCALE__PERSISTENT_CONFIG_H
 
+#include <algorithm>
 #include <ArduinoJson.h>
+#include <coredecls.h>
 #include <ESP_EEPROM.h>
+#include <stddef.h>
 #include <vector>
 
+#include "config.h"
+#include "hash.h"
+#include "logger.h"
+
+#define PERSISTENT_CONFIG_MAGIC               0x4b534350
+#define PERSISTENT_CONFIG_VERSION             1
+// more than the number of scales, so removed scales keep their calibration for a while
+#define PERSISTENT_CONFIG_MAX_RECORDS         8
+
 struct ScaleCalibration {
   long tareOffset;
   float calibrationFactor;
@@ -15,38 +27,177 @@ struct ScaleCalibration {
   }
 };
 
+struct PersistentConfigHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t numRecords;
+};
+
+// The calibration of a scale, identified by the hash of its label,
+// so that adding, removing or reordering scales does not mix them up.
+struct CalibrationRecord {
+  uint32_t labelHash;
+  ScaleCalibration calibration;
+  uint32_t crc;
+
+  uint32_t computeCrc() const {
+    return crc32(this, offsetof(CalibrationRecord, crc));
+  }
+
+  bool isValid() const {
+    return this->crc == this->computeCrc();
+  }
+};
+
 class PersistentConfig {
 
 private:
   int numScales; // TODO make this unsigned or simply size_t
   ScaleCalibration *calibrationData;
+  uint32_t revision;
+
+  // the image of the EEPROM, and the record of each scale in it (or -1 before its first save)
+  PersistentConfigHeader header;
+  CalibrationRecord records[PERSISTENT_CONFIG_MAX_RECORDS];
+  std::vector<int> recordIndices;
+  std::vector<uint32_t> labelHashes;
+  // records moved when corrupted ones were dropped, so all of them are written on the next commit
+  bool isCompacted;
+
+  static size_t getDataSize() {
+    return sizeof(PersistentConfigHeader) + PERSISTENT_CONFIG_MAX_RECORDS * sizeof(CalibrationRecord);
+  }
+
+  static size_t getRecordOffset(int recordIndex) {
+    return sizeof(PersistentConfigHeader) + recordIndex * sizeof(CalibrationRecord);
+  }
+
+  int findRecord(uint32_t labelHash) {
+    for (int i = 0; i < this->header.numRecords; ++i) {
+      if (this->records[i].labelHash == labelHash) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  // a new record, or one of a scale which is not configured anymore
+  int allocateRecord() {
+    if (this->header.numRecords < PERSISTENT_CONFIG_MAX_RECORDS) {
+      return this->header.numRecords++;
+    }
+    for (int i = 0; i < PERSISTENT_CONFIG_MAX_RECORDS; ++i) {
+      bool isUsed = false;
+      for (int recordIndex : this->recordIndices) {
+        isUsed = isUsed || recordIndex == i;
+      }
+      if (!isUsed) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  // Moves the calibrations of the format before the records, which were stored in the order of the scales.
+  bool migrateLegacyCalibrations(const std::vector<ScaleConfig> &scales) {
+    if (this->numScales == 0) {
+      return false;
+    }
+    // the library finds no data when opened at another size than the one it was committed with
+    EEPROM.begin(this->numScales * sizeof(ScaleCalibration));
+    if (EEPROM.percentUsed() < 0) {
+      EEPROM.begin(getDataSize());
+      return false;
+    }
+
+    int numRecords = std::min(this->numScales, PERSISTENT_CONFIG_MAX_RECORDS);
+    int offset = 0;
+    for (int i = 0; i < numRecords; ++i) {
+      CalibrationRecord &record = this->records[i];
+      record.labelHash = fnv1aHash(scales[i].label, strlen(scales[i].label));
+      EEPROM.get(offset, record.calibration.tareOffset);
+      offset += sizeof(record.calibration.tareOffset);
+      EEPROM.get(offset, record.calibration.calibrationFactor);
+      offset += sizeof(record.calibration.calibrationFactor);
+      record.crc = record.computeCrc();
+    }
+
+    // the blocks of the old size cannot be followed by ones of the new size
+    EEPROM.wipe();
+    EEPROM.begin(getDataSize());
+    this->header.magic = PERSISTENT_CONFIG_MAGIC;
+    this->header.version = PERSISTENT_CONFIG_VERSION;
+    this->header.numRecords = numRecords;
+    EEPROM.put(0, this->header);
+    for (int i = 0; i < numRecords; ++i) {
+      EEPROM.put(getRecordOffset(i), this->records[i]);
+    }
+    if (!EEPROM.commit()) {
+      LOG_ERROR("[PersistentConfig] Committing migrated calibrations failed.");
+    }
+    Logger.printf("[PersistentConfig] Migrated %d calibrations of the previous format.\n", numRecords);
+    return true;
+  }
 
 public:
+  PersistentConfig()
+    : numScales(0)
+    , calibrationData(nullptr)
+    , revision(0)
+    , header{}
+    , isCompacted(false) {};
 
-  void load(int numScales) {
-    this->numScales = numScales;
+  void load(const std::vector<ScaleConfig> &scales) {
+    this->numScales = scales.size();
     this->calibrationData = new ScaleCalibration[this->numScales];
+    this->revision = 0;
 
-    EEPROM.begin(this->numScales * sizeof(ScaleCalibration));
+    EEPROM.begin(getDataSize());
     bool hasData = EEPROM.percentUsed() >= 0;
+    if (hasData) {
+      EEPROM.get(0, this->header);
+    }
 
-    if (!hasData) {
-      // destroy previously saved data when reconfigured
-      EEPROM.commit();
+    // the migrated records are read back below, like after any other boot
+    bool isMigrated = (!hasData || this->header.magic != PERSISTENT_CONFIG_MAGIC) && this->migrateLegacyCalibrations(scales);
+    if (!isMigrated && (!hasData
+      || this->header.magic != PERSISTENT_CONFIG_MAGIC
+      || this->header.version != PERSISTENT_CONFIG_VERSION
+      || this->header.numRecords > PERSISTENT_CONFIG_MAX_RECORDS)) {
+      if (hasData) {
+        LOG_WARNING("[PersistentConfig] Unknown data format (version %u), calibrations are reset.", this->header.version);
+      }
+      this->header.magic = PERSISTENT_CONFIG_MAGIC;
+      this->header.version = PERSISTENT_CONFIG_VERSION;
+      this->header.numRecords = 0;
     }
 
-    int offset = 0;
+    // corrupted records are dropped, the remaining ones are compacted
+    int numValidRecords = 0;
+    for (int i = 0; i < this->header.numRecords; ++i) {
+      CalibrationRecord &record = this->records[numValidRecords];
+      EEPROM.get(getRecordOffset(i), record);
+      if (record.isValid()) {
+        ++numValidRecords;
+      } else {
+        LOG_WARNING("[PersistentConfig] Dropping calibration record %d with invalid CRC.", i);
+      }
+    }
+    this->isCompacted = numValidRecords != this->header.numRecords;
+    this->header.numRecords = numValidRecords;
+
     for (int i = 0; i < this->numScales; ++i) {
       ScaleCalibration *current = &this->calibrationData[i];
-      current->tareOffset = 0;
-      current->calibrationFactor = 1.0;
-
-      if (hasData) {
-        EEPROM.get(offset, current->tareOffset);
-        offset += sizeof(current->tareOffset);
-        EEPROM.get(offset, current->calibrationFactor);
-        offset += sizeof(current->calibrationFactor);
+      uint32_t labelHash = fnv1aHash(scales[i].label, strlen(scales[i].label));
+      int recordIndex = this->findRecord(labelHash);
+      if (recordIndex >= 0) {
+        *current = this->records[recordIndex].calibration;
+      } else {
+        current->tareOffset = 0;
+        current->calibrationFactor = 1.0;
       }
+      this->labelHashes.push_back(labelHash);
+      this->recordIndices.push_back(recordIndex);
     }
   }
 
@@ -54,19 +205,53 @@ public:
     return &this->calibrationData[index];
   }
 
+  // Commits the calibrations which changed since the last save, if there are any.
   bool save() {
-    int offset = 0;
+    bool isDirty = false;
     for (int i = 0; i < this->numScales; ++i) {
       ScaleCalibration *current = &this->calibrationData[i];
-      EEPROM.put(offset, current->tareOffset);
-      offset += sizeof(current->tareOffset);
-      EEPROM.put(offset, current->calibrationFactor);
-      offset += sizeof(current->calibrationFactor);
+      int recordIndex = this->recordIndices[i];
+      if (recordIndex >= 0 && memcmp(&this->records[recordIndex].calibration, current, sizeof(ScaleCalibration)) == 0) {
+        continue;
+      }
+
+      if (recordIndex < 0) {
+        recordIndex = this->allocateRecord();
+        if (recordIndex < 0) {
+          LOG_ERROR("[PersistentConfig] No free calibration record for scale %d.", i);
+          continue;
+        }
+        this->recordIndices[i] = recordIndex;
+      }
+
+      CalibrationRecord &record = this->records[recordIndex];
+      record.labelHash = this->labelHashes[i];
+      record.calibration = *current;
+      record.crc = record.computeCrc();
+      EEPROM.put(getRecordOffset(recordIndex), record);
+      isDirty = true;
+    }
+
+    if (!isDirty) {
+      return true;
     }
 
+    if (this->isCompacted) {
+      for (int i = 0; i < this->header.numRecords; ++i) {
+        EEPROM.put(getRecordOffset(i), this->records[i]);
+      }
+      this->isCompacted = false;
+    }
+    EEPROM.put(0, this->header);
+    ++this->revision;
     return EEPROM.commit();
   }
 
+  // changes on each save, so that renders of the saved data can be cached until then
+  uint32_t getRevision() {
+    return this->revision;
+  }
+
   void render(JsonDocument &doc) {
     JsonArray arr = doc.createNestedArray("calibrationData");
     for (int i = 0; i < this->numScales; ++i) {
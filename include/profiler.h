@@ -0,0 +1,194 @@
+#ifndef KEG_SCALE__PROFILER_H
+#define KEG_SCALE__PROFILER_H
+
+// Measures the latency of the loop phases and of the scale state updates,
+// to find what delays reading the ADCs. Without it, the macros below are empty.
+// #define ENABLE_LOOP_PROFILER
+
+#ifdef ENABLE_LOOP_PROFILER
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define PROFILER_NUM_BUCKETS      10
+#define PROFILER_MAX_SCALE_STATES 10
+
+enum class ProfiledPhase {
+  Network,
+  Ota,
+  Catalog,
+  Scales,
+  Logger,
+  Count
+};
+
+// Counts latencies in fixed buckets with upper limits of PROFILER_BUCKET_LIMITS_MICROS,
+// with the last bucket counting everything above those.
+class LatencyHistogram {
+
+private:
+  uint32_t counts[PROFILER_NUM_BUCKETS];
+  // the loop alone adds up to more than 32 bits in about 71 minutes
+  uint64_t totalMicros;
+  uint32_t maxMicros;
+
+public:
+  static const uint32_t bucketLimitsMicros[PROFILER_NUM_BUCKETS - 1];
+
+  LatencyHistogram() : counts{}, totalMicros(0), maxMicros(0) {};
+
+  void record(uint32_t micros) {
+    size_t bucket = 0;
+    while (bucket < PROFILER_NUM_BUCKETS - 1 && micros > bucketLimitsMicros[bucket]) {
+      ++bucket;
+    }
+    ++this->counts[bucket];
+    this->totalMicros += micros;
+    if (micros > this->maxMicros) {
+      this->maxMicros = micros;
+    }
+  }
+
+  void render(JsonObject obj) const {
+    uint32_t count = 0;
+    JsonArray histogram = obj.createNestedArray("histogram");
+    for (size_t i = 0; i < PROFILER_NUM_BUCKETS; ++i) {
+      histogram.add(this->counts[i]);
+      count += this->counts[i];
+    }
+    obj["count"] = count;
+    obj["meanMicros"] = count > 0 ? (uint32_t) (this->totalMicros / count) : 0;
+    obj["maxMicros"] = this->maxMicros;
+  }
+};
+
+class ProfilerClass {
+
+private:
+  uint32_t cyclesPerMicro;
+
+  LatencyHistogram loopHistogram;
+  LatencyHistogram phaseHistograms[(size_t) ProfiledPhase::Count];
+
+  const char *scaleStateNames[PROFILER_MAX_SCALE_STATES];
+  LatencyHistogram scaleStateHistograms[PROFILER_MAX_SCALE_STATES];
+  size_t numScaleStates;
+
+  uint32_t loopStart;
+  uint32_t loopsInWindow;
+  uint32_t windowStartMillis;
+  uint32_t loopsPerSecond;
+
+public:
+  ProfilerClass()
+    : cyclesPerMicro(0)
+    , numScaleStates(0)
+    , loopStart(0)
+    , loopsInWindow(0)
+    , windowStartMillis(0)
+    , loopsPerSecond(0) {};
+
+  uint32_t toMicros(uint32_t cycles) {
+    if (this->cyclesPerMicro == 0) {
+      this->cyclesPerMicro = ESP.getCpuFreqMHz();
+    }
+    return cycles / this->cyclesPerMicro;
+  }
+
+  void beginLoop() {
+    uint32_t now = ESP.getCycleCount();
+    if (this->loopStart != 0) {
+      // the time between loop() calls is spent by the core, e.g. on WiFi, so it counts as well
+      this->loopHistogram.record(this->toMicros(now - this->loopStart));
+    }
+    this->loopStart = now;
+
+    ++this->loopsInWindow;
+    uint32_t nowMillis = millis();
+    if (nowMillis - this->windowStartMillis >= 1000) {
+      this->loopsPerSecond = this->loopsInWindow * 1000 / (nowMillis - this->windowStartMillis);
+      this->loopsInWindow = 0;
+      this->windowStartMillis = nowMillis;
+    }
+  }
+
+  void recordPhase(ProfiledPhase phase, uint32_t cycles) {
+    this->phaseHistograms[(size_t) phase].record(this->toMicros(cycles));
+  }
+
+  void recordScaleState(const char *name, uint32_t cycles) {
+    size_t i = 0;
+    while (i < this->numScaleStates && strcmp(this->scaleStateNames[i], name) != 0) {
+      ++i;
+    }
+    if (i == this->numScaleStates) {
+      if (i == PROFILER_MAX_SCALE_STATES) {
+        return;
+      }
+      this->scaleStateNames[i] = name;
+      ++this->numScaleStates;
+    }
+    this->scaleStateHistograms[i].record(this->toMicros(cycles));
+  }
+
+  void render(JsonDocument &doc) const {
+    static const char *phaseNames[] = {"network", "ota", "catalog", "scales", "logger"};
+
+    JsonObject loop = doc.createNestedObject("loop");
+    loop["loopsPerSecond"] = this->loopsPerSecond;
+    this->loopHistogram.render(loop);
+
+    JsonObject phases = doc.createNestedObject("phases");
+    for (size_t i = 0; i < (size_t) ProfiledPhase::Count; ++i) {
+      this->phaseHistograms[i].render(phases.createNestedObject(phaseNames[i]));
+    }
+
+    JsonObject scaleStates = doc.createNestedObject("scaleStates");
+    for (size_t i = 0; i < this->numScaleStates; ++i) {
+      this->scaleStateHistograms[i].render(scaleStates.createNestedObject(this->scaleStateNames[i]));
+    }
+
+    JsonArray bucketLimits = doc.createNestedArray("bucketLimitsMicros");
+    for (uint32_t limit : LatencyHistogram::bucketLimitsMicros) {
+      bucketLimits.add(limit);
+    }
+  }
+};
+
+extern ProfilerClass Profiler;
+
+// Records the cycles from its construction until the end of the enclosing scope.
+class ProfiledScope {
+
+private:
+  ProfiledPhase phase;
+  const char *scaleState;
+  uint32_t start;
+
+public:
+  ProfiledScope(ProfiledPhase _phase) : phase(_phase), scaleState(nullptr), start(ESP.getCycleCount()) {};
+  ProfiledScope(const char *_scaleState) : phase(ProfiledPhase::Count), scaleState(_scaleState), start(ESP.getCycleCount()) {};
+
+  ~ProfiledScope() {
+    uint32_t cycles = ESP.getCycleCount() - this->start;
+    if (this->scaleState != nullptr) {
+      Profiler.recordScaleState(this->scaleState, cycles);
+    } else {
+      Profiler.recordPhase(this->phase, cycles);
+    }
+  }
+};
+
+#define PROFILE_LOOP()                  Profiler.beginLoop()
+#define PROFILE_PHASE(phase)            ProfiledScope profiledPhase(ProfiledPhase::phase)
+#define PROFILE_SCALE_STATE(stateName)  ProfiledScope profiledScaleState(stateName)
+
+#else
+
+#define PROFILE_LOOP()
+#define PROFILE_PHASE(phase)
+#define PROFILE_SCALE_STATE(stateName)
+
+#endif
+
+#endif
@@ -5,7 +5,12 @@
 #include <ESPDateTime.h>
 #include <vector>
 
+#include "arena.h"
+#include "clock.h"
+#include "crash_trace.h"
+#include "json_writer.h"
 #include "logger.h"
+#include "metrics.h"
 
 #define MEASURED_POINTS_IN_LITERS 20
 
@@ -15,6 +20,9 @@
 
 #define MAX_PARTIAL_RENDER_TIME_DELAY_SECONDS 10
 
+// Reconnecting clients which missed more of a recording than this get a full render instead of a delta.
+#define MAX_RESUME_CURSOR_AGE_SECONDS 3600
+
 struct TapEntry {
   char id[32];
   uint8_t number;
@@ -27,40 +35,44 @@ struct TapEntry {
   float abv;
   float srm;
 
-  void render(JsonObject &obj) {
-    obj["id"] = this->id;
-    obj["number"] = this->number;
-    obj["name"] = this->name;
-    obj["bottlingDate"] = DateFormatter::format(DateFormatter::DATE_ONLY, this->bottlingDate);
-    obj["bottlingVolume"] = this->bottlingVolume;
-    obj["useBottlingVolume"] = this->useBottlingVolume;
-    obj["tareOffset"] = this->tareOffset;
-    obj["finalGravity"] = this->finalGravity;
-    obj["abv"] = this->abv;
-    obj["srm"] = this->srm;
-  }
-
-  static TapEntry *fromJson(const JsonObject &obj) {
-    TapEntry *entry = new TapEntry;
-    strlcpy(entry->id, obj["id"] | "", sizeof(entry->id));
-    entry->number = obj["number"] | 0;
-    strlcpy(entry->name, obj["name"] | "", sizeof(entry->name));
+  void render(JsonWriter &writer) {
+    writer.member("id", this->id);
+    writer.member("number", this->number);
+    writer.member("name", this->name);
+    writer.memberTime("bottlingDate", DateFormatter::DATE_ONLY, this->bottlingDate);
+    writer.member("bottlingVolume", this->bottlingVolume);
+    writer.member("useBottlingVolume", this->useBottlingVolume);
+    writer.member("tareOffset", this->tareOffset);
+    writer.member("finalGravity", this->finalGravity);
+    writer.member("abv", this->abv);
+    writer.member("srm", this->srm);
+  }
+
+  // parses into an existing entry, usually the one inside a recording entry
+  static void fromJson(const JsonObject &obj, TapEntry &entry) {
+    strlcpy(entry.id, obj["id"] | "", sizeof(entry.id));
+    entry.number = obj["number"] | 0;
+    strlcpy(entry.name, obj["name"] | "", sizeof(entry.name));
 
     struct tm bottlingDateTm = {0};
-    strptime(obj["bottlingDate"], "%Y-%m-%d", &bottlingDateTm);
-    entry->bottlingDate = mktime(&bottlingDateTm);
-
-    entry->bottlingVolume = obj["bottlingVolume"];
-    entry->useBottlingVolume = obj["useBottlingVolume"];
-    entry->tareOffset = obj["tareOffset"];
-    entry->finalGravity = obj["finalGravity"];
-    entry->abv = obj["abv"];
-    entry->srm = obj["srm"];
-    return entry;
+    strptime(obj["bottlingDate"] | "", "%Y-%m-%d", &bottlingDateTm);
+    entry.bottlingDate = mktime(&bottlingDateTm);
+
+    entry.bottlingVolume = obj["bottlingVolume"];
+    entry.useBottlingVolume = obj["useBottlingVolume"];
+    entry.tareOffset = obj["tareOffset"];
+    entry.finalGravity = obj["finalGravity"];
+    entry.abv = obj["abv"];
+    entry.srm = obj["srm"];
   }
 };
 
+// Holds one recording per scale, and one more for an upload being parsed.
+extern SlotArena RecordingArena;
+
 struct RecordingEntry {
+  // Assigned by the recorder, so that clients can tell recordings apart when resuming.
+  uint32_t id;
   TapEntry tapEntry;
   time_t startDateTime;
   bool isPaused;
@@ -80,34 +92,75 @@ struct RecordingEntry {
   // and we don't allow next time to fill larger indices than this.
   int latestValue;
 
-  void render(JsonObject &obj, bool isFull = true) {
-    obj["isPaused"] = this->isPaused;
+  // Renders the data points reached at or after the given time, all of them for zero.
+  void renderData(JsonWriter &writer, time_t since) {
+    writer.beginObject("data");
+    int pending = -1;
+    for (int i = 0; i < RECORDING_ENTRY_NUM_RAW_DATA_ITEMS; ++i) {
+      time_t timestamp = this->rawData[i];
+      if (timestamp == 0 || timestamp < since) {
+        continue;
+      }
+      // points reached in the same second share their key, where the largest volume wins
+      if (pending >= 0 && this->rawData[pending] != timestamp) {
+        writer.member(this->rawData[pending], ((float) pending) / MEASURED_POINTS_IN_LITERS);
+      }
+      pending = i;
+    }
+    if (pending >= 0) {
+      writer.member(this->rawData[pending], ((float) pending) / MEASURED_POINTS_IN_LITERS);
+    }
+    writer.endObject();
+  }
+
+  void renderDetails(JsonWriter &writer, bool isFull) {
+    writer.member("recordingId", this->id);
 
     if (isFull) {
-      obj["startDateTime"] = DateFormatter::format(DateFormatter::SIMPLE, this->startDateTime);
-      JsonObject tapEntry = obj.createNestedObject("tapEntry");
-      this->tapEntry.render(tapEntry);
+      writer.memberTime("startDateTime", DateFormatter::SIMPLE, this->startDateTime);
+      writer.beginObject("tapEntry");
+      this->tapEntry.render(writer);
+      writer.endObject();
     }
+  }
 
-    time_t now = DateTime.now();
-    JsonObject data = obj.createNestedObject("data");
-    for (int i = 0; i < RECORDING_ENTRY_NUM_RAW_DATA_ITEMS; ++i) {
-      time_t timestamp = this->rawData[i];
-      if (timestamp != 0 && (isFull || now - timestamp < MAX_PARTIAL_RENDER_TIME_DELAY_SECONDS)) {
-        data[String(timestamp)] = ((float) i) / MEASURED_POINTS_IN_LITERS;
-      }
+  // noexcept, so that running out of memory gives nullptr instead of an abort
+  static void *operator new(size_t size) noexcept {
+    return RecordingArena.allocate(size);
+  }
+
+  static void operator delete(void *ptr, size_t size) {
+    RecordingArena.deallocate(ptr, size);
+  }
+
+  // creates an empty recording for a tap entry, which is started by the recorder
+  static RecordingEntry *forTapEntry(const JsonObject &tapEntryObj) {
+    RecordingEntry *entry = new RecordingEntry;
+    if (entry == nullptr) {
+      return nullptr;
     }
+
+    entry->id = 0;
+    TapEntry::fromJson(tapEntryObj, entry->tapEntry);
+    entry->startDateTime = 0;
+    entry->isPaused = false;
+    memset(entry->rawData, 0, sizeof(entry->rawData));
+    entry->latestValue = RECORDING_ENTRY_NUM_RAW_DATA_ITEMS;
+    return entry;
   }
 
+  // creates a recording from an exported one
   static RecordingEntry *fromJson(const JsonObject &obj) {
     RecordingEntry *entry = new RecordingEntry;
+    if (entry == nullptr) {
+      return nullptr;
+    }
 
-    TapEntry *tapEntry = TapEntry::fromJson(obj["tapEntry"]);
-    memcpy(&entry->tapEntry, tapEntry, sizeof(entry->tapEntry));
-    delete tapEntry;
+    entry->id = 0;
+    TapEntry::fromJson(obj["tapEntry"], entry->tapEntry);
 
     struct tm startDateTimeTm = {0};
-    strptime(obj["startDateTime"], "%Y-%m-%d %H:%M:%S", &startDateTimeTm);
+    strptime(obj["startDateTime"] | "", "%Y-%m-%d %H:%M:%S", &startDateTimeTm);
     entry->startDateTime = mktime(&startDateTimeTm);
 
     entry->isPaused = obj["isPaused"] | true;
@@ -116,8 +169,10 @@ struct RecordingEntry {
     JsonObject data = obj["data"].as<JsonObject>();
     for (JsonPair kv : data) {
       int index = (int) round(kv.value().as<float>() * MEASURED_POINTS_IN_LITERS);
-      time_t timestamp = (time_t) atoi(kv.key().c_str());
-      entry->rawData[index] = timestamp;
+      if (index < 0 || index >= RECORDING_ENTRY_NUM_RAW_DATA_ITEMS) {
+        continue;
+      }
+      entry->rawData[index] = (time_t) atoi(kv.key().c_str());
     }
 
     entry->latestValue = RECORDING_ENTRY_NUM_RAW_DATA_ITEMS;
@@ -127,11 +182,30 @@ struct RecordingEntry {
 
 class Recorder {
 
+  // the host benchmarks render the recordings the way the firmware did before the JsonWriter
+  friend class ScalesBenchmark;
+
 private:
   std::vector<RecordingEntry*> entries;
+  uint32_t lastRecordingId;
+
+  // Never earlier than the previous point, i.e. the closest larger volume, even when NTP stepped the
+  // time back meanwhile. Only this recording waits for the time to catch up, not the whole clock.
+  time_t nextTimestamp(RecordingEntry *entry, int value) {
+    time_t now = Clock.now();
+    for (int i = value + 1; i < RECORDING_ENTRY_NUM_RAW_DATA_ITEMS; ++i) {
+      if (entry->rawData[i] != 0) {
+        return entry->rawData[i] > now ? entry->rawData[i] : now;
+      }
+    }
+    return now;
+  }
 
 public:
   bool load(int numScales) {
+    // random seed avoids matching stale resume cursors of clients after a reboot
+    this->lastRecordingId = ESP.random();
+    RecordingArena.begin(numScales + 1);
     for (int i = 0; i < numScales; ++i) {
       this->entries.push_back(nullptr);
     }
@@ -148,49 +222,51 @@ public:
     return this->entries[index] != nullptr;
   }
 
-  bool start(int index, TapEntry *tapEntry, float currentMass) {
+  // takes the ownership of the new entry, which is dropped when continuing an existing recording
+  bool start(int index, RecordingEntry *newEntry, float currentMass) {
     if (this->hasRecording(index)) {
       Logger.printf("[Recorder] Continue recording for scale %d.\n", index);
       this->entries[index]->isPaused = false;
+      delete newEntry;
       return true;
-    } else if (tapEntry != nullptr) {
-      Logger.printf("[Recorder] Start recording for scale %d (%s).\n", index, tapEntry->name);
+    } else if (newEntry != nullptr) {
+      Logger.printf("[Recorder] Start recording for scale %d (%s).\n", index, newEntry->tapEntry.name);
 
-      RecordingEntry *newEntry = new RecordingEntry;
-      memcpy(&newEntry->tapEntry, tapEntry, sizeof(newEntry->tapEntry));
-      delete tapEntry;
-
-      newEntry->startDateTime = DateTime.now();
+      newEntry->id = ++this->lastRecordingId;
+      newEntry->startDateTime = Clock.now();
       newEntry->isPaused = false;
-      memset(newEntry->rawData, 0, sizeof(newEntry->rawData));
-      newEntry->latestValue = RECORDING_ENTRY_NUM_RAW_DATA_ITEMS;
 
       if (newEntry->tapEntry.useBottlingVolume) {
         newEntry->tapEntry.tareOffset = currentMass - (newEntry->tapEntry.bottlingVolume * newEntry->tapEntry.finalGravity);
       }
 
       this->entries[index] = newEntry;
+      CrashTrace.recordRecorderCursor(index, newEntry->id, newEntry->latestValue);
       return true;
     } else {
-      Logger.printf("[Recorder] Unable to start or continue recording for scale %d.\n", index);
+      LOG_ERROR("[Recorder] Unable to start or continue recording for scale %d.", index);
       return false;
     }
   }
 
+  // takes the ownership of the uploaded entry
   bool putEntry(int index, RecordingEntry *recordingEntry) {
     if (this->hasRecording(index)) {
-      Logger.printf("[Recorder] Unable to upload new recording data for scale %d.\n", index);
+      LOG_ERROR("[Recorder] Unable to upload new recording data for scale %d.", index);
+      delete recordingEntry;
       return false;
     } else {
       Logger.printf("[Recorder] Continue recording from upload for scale %d (%s).\n", index, recordingEntry->tapEntry.name);
+      recordingEntry->id = ++this->lastRecordingId;
       this->entries[index] = recordingEntry;
+      CrashTrace.recordRecorderCursor(index, recordingEntry->id, recordingEntry->latestValue);
       return true;
     }
   }
 
   void pause(int index) {
     if (!this->hasRecording(index)) {
-      Logger.printf("[Recorder] Unable to pause recording for scale %d.\n", index);
+      LOG_ERROR("[Recorder] Unable to pause recording for scale %d.", index);
       return;
     }
 
@@ -200,7 +276,7 @@ public:
 
   void stop(int index) {
     if (!this->hasRecording(index)) {
-      Logger.printf("[Recorder] Unable to stop recording for scale %d.\n", index);
+      LOG_ERROR("[Recorder] Unable to stop recording for scale %d.", index);
       return;
     }
 
@@ -208,16 +284,18 @@ public:
     RecordingEntry *entry = this->entries[index];
     this->entries[index] = nullptr;
     delete entry;
+    CrashTrace.recordRecorderCursor(index, 0, 0);
   }
 
   bool update(int index, float mass) {
     if (!this->hasRecording(index)) {
-      Logger.printf("[Recorder] Unable to update recording entry for scale %d.\n", index);
+      LOG_ERROR("[Recorder] Unable to update recording entry for scale %d.", index);
       return false;
     }
 
     RecordingEntry *entry = this->entries[index];
-    if (entry->isPaused) {
+    // after a power loss, there is no time for the points until NTP provides it
+    if (entry->isPaused || !Clock.isValid()) {
       return false;
     }
 
@@ -239,16 +317,58 @@ public:
 
     if (entry->rawData[value] == 0) {
       entry->latestValue = value;
-      entry->rawData[value] = DateTime.now();
+      entry->rawData[value] = this->nextTimestamp(entry, value);
+      ++Metrics.forScale(index).recordedPoints;
+      CrashTrace.recordRecorderCursor(index, entry->id, value);
       return true;
     } else {
       return false;
     }
   }
 
-  void render(int index, JsonObject &obj, bool isFull) {
+  bool isPaused(int index) {
+    return this->entries[index]->isPaused;
+  }
+
+  void renderData(int index, JsonWriter &writer, time_t since) {
+    this->entries[index]->renderData(writer, since);
+  }
+
+  void renderDetails(int index, JsonWriter &writer, bool isFull) {
+    this->entries[index]->renderDetails(writer, isFull);
+  }
+
+  bool canResume(int index, uint32_t recordingId, time_t since) {
+    if (!this->hasRecording(index) || this->entries[index]->id != recordingId) {
+      return false;
+    }
+
+    // The cursor is the time of the last point the client got. What it missed is measured from the
+    // first point after the cursor to the last point, rather than from the cursor to now, so that
+    // the cursors of kegs without any pour meanwhile stay valid, however long ago that was.
+    // Smaller volumes have later times, so the points are walked from the last one backwards.
     RecordingEntry *entry = this->entries[index];
-    entry->render(obj, isFull);
+    time_t lastPointTime = 0;
+    time_t firstMissedTime = 0;
+    for (int i = 0; i < RECORDING_ENTRY_NUM_RAW_DATA_ITEMS; ++i) {
+      time_t timestamp = entry->rawData[i];
+      if (timestamp == 0) {
+        continue;
+      }
+      if (lastPointTime == 0) {
+        lastPointTime = timestamp;
+      }
+      if (timestamp <= since) {
+        break;
+      }
+      firstMissedTime = timestamp;
+    }
+
+    // clients only have cursors of points they got
+    if (since > lastPointTime) {
+      return false;
+    }
+    return firstMissedTime == 0 || lastPointTime - firstMissedTime <= MAX_RESUME_CURSOR_AGE_SECONDS;
   }
 };
 
@@ -0,0 +1,11 @@
+#ifndef KEG_SCALE__RTC_MEMORY_H
+#define KEG_SCALE__RTC_MEMORY_H
+
+// Layout of the 512 bytes of RTC user memory, which survives every reset except a power loss.
+// Offsets and sizes are in 4 byte blocks, as expected by ESP.rtcUserMemoryRead/Write().
+#define RTC_MEMORY_OTA_OFFSET         0 // used by eboot while updating OTA
+#define RTC_MEMORY_CRASH_TRACE_OFFSET 32
+#define RTC_MEMORY_CLOCK_OFFSET       118
+#define RTC_MEMORY_SIZE               128
+
+#endif
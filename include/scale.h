@@ -1,22 +1,16 @@
 #ifndef KEG_SCALE__SCALE_H
 #define KEG_SCALE__SCALE_H
 
-#include <ArduinoJson.h>
 #include <HX711_ADC.h>
 
 #include "config.h"
+#include "json_writer.h"
 #include "persistent_config.h"
 #include "recorder.h"
 #include "scale_state.h"
 
 // #define RENDER_SCALE_ADC_FOR_DEBUG
 
-#ifdef RENDER_SCALE_ADC_FOR_DEBUG
-  #define MAKE_SCALE_JSON_DOC(id) DynamicJsonDocument id(1536);
-#else
-  #define MAKE_SCALE_JSON_DOC(id) StaticJsonDocument<1024> id;
-#endif
-
 enum class UpdateResult {
   StateChange,
   StateUpdate,
@@ -34,6 +28,8 @@ private:
   bool adcOnlineFlag;
   ScaleState *currentState;
   ScaleState *nextState;
+  // lower bound for the timestamps of recorded points in the render in progress
+  time_t renderSince;
 
 public:
   Scale(int _index, ScaleConfig &_config, ScaleCalibration *_calibration, Recorder &_recorder)
@@ -42,8 +38,10 @@ public:
     , calibration(_calibration)
     , recorder(_recorder)
     , adc(_config.dataPin, _config.clockPin)
+    , adcOnlineFlag(false)
     , currentState(nullptr)
-    , nextState(nullptr) {
+    , nextState(nullptr)
+    , renderSince(0) {
     if (this->config.reverse) {
       this->adc.setReverseOutput();
     }
@@ -52,26 +50,37 @@ public:
   // public interface
   void begin();
   UpdateResult update();
-  void render(JsonDocument &doc, bool isFull);
+  void render(JsonWriter &writer, bool isFull, time_t since);
+  bool canResume(uint32_t recordingId, time_t since);
+  // whether the full render stays the same until the next state change or update
+  bool isRenderCacheable() {
+    return this->currentState != nullptr && !this->currentState->rendersLiveData();
+  }
+  // whether a state was set, which is only entered on the next update
+  bool hasPendingState() {
+    return this->nextState != nullptr;
+  }
 
   void standby();
   void liveMeasurement();
   void tare();
   void calibrate(float knownMass);
-  void startRecording(TapEntry *tapEntry);
-  void startRecording(RecordingEntry *recordingEntry);
+  void startRecording(RecordingEntry *newEntry);
+  void restoreRecording(RecordingEntry *uploadedEntry);
   void pauseRecording();
   void continueRecording();
   void stopRecording();
 
   // functions used by different scale states
   void setState(ScaleState *newState);
-  bool startRecorder(TapEntry *tapEntry = nullptr);
+  bool startRecorder(RecordingEntry *newEntry = nullptr);
   bool putRecordingEntry(RecordingEntry *recordingEntry);
   void pauseRecorder();
   void stopRecorder();
   bool updateRecorder();
-  void renderRecorder(JsonObject &obj, bool isFull);
+  bool isRecorderPaused();
+  void renderRecorderData(JsonWriter &writer);
+  void renderRecorderDetails(JsonWriter &writer, bool isFull);
 
   void startAdc();
   uint8_t updateAdc();
@@ -1,12 +1,10 @@
 #ifndef KEG_SCALE__SCALE_STATE_H
 #define KEG_SCALE__SCALE_STATE_H
 
-#include <ArduinoJson.h>
-#include <ESPDateTime.h>
-
+#include "json_writer.h"
 #include "recorder.h"
 
-#define LIVE_MEASUREMENT_REFRESH_SECONDS 1
+#define LIVE_MEASUREMENT_REFRESH_MILLIS 1000
 
 class Scale;
 
@@ -22,7 +20,16 @@ public:
   virtual bool update() = 0;
   virtual void exit(ScaleState *nextState) = 0;
 
-  virtual void render(JsonObject &state, bool isFull) const = 0;
+  virtual void render(JsonWriter &writer, bool isFull) const = 0;
+
+  // identifies the state in profiles
+  virtual const char *getName() const = 0;
+
+  // tells whether the state renders the recording of the scale
+  virtual bool isRecording() const { return false; }
+
+  // tells whether the render shows the current reading of the ADC, which changes without any update
+  virtual bool rendersLiveData() const { return false; }
 };
 
 class OnlineScaleState : public ScaleState {
@@ -32,47 +39,60 @@ public:
   bool update() override;
   void exit(ScaleState *nextState) override {};
 
-  void render(JsonObject &state, bool isFull) const override;
+  void render(JsonWriter &writer, bool isFull) const override;
+  bool rendersLiveData() const override { return true; }
 };
 
 class StandbyScaleState : public OnlineScaleState {
 
 public:
-  void render(JsonObject &state, bool isFull) const override;
+  void render(JsonWriter &writer, bool isFull) const override;
+  const char *getName() const override { return "standby"; }
 };
 
 
 class LiveMeasurementScaleState : public OnlineScaleState {
 
 private:
-  time_t lastRefresh;
+  uint32_t lastRefreshMillis;
 
 public:
   void enter(Scale *scale, ScaleState *prevState) override;
   bool update() override;
 
-  void render(JsonObject &state, bool isFull) const override;
+  void render(JsonWriter &writer, bool isFull) const override;
+  const char *getName() const override { return "liveMeasurement"; }
 };
 
 class RecordingScaleState : public OnlineScaleState {
 
-  TapEntry *tapEntry;
+  // owned until it is handed to the recorder on enter()
   RecordingEntry *recordingEntry;
+  bool isUploaded;
 
 public:
-  // constructor to start new recording
-  RecordingScaleState(TapEntry *_tapEntry) : tapEntry(_tapEntry), recordingEntry(nullptr) {};
-
-  // constructor to start recording from an exported entry
-  RecordingScaleState(RecordingEntry *_recordingEntry) : tapEntry(nullptr), recordingEntry(_recordingEntry) {};
+  // constructor to start a new recording, or one from an exported entry
+  RecordingScaleState(RecordingEntry *_recordingEntry, bool _isUploaded) : recordingEntry(_recordingEntry), isUploaded(_isUploaded) {};
 
   // constructor to continue recording
-  RecordingScaleState() : tapEntry(nullptr), recordingEntry(nullptr) {};
+  RecordingScaleState() : recordingEntry(nullptr), isUploaded(false) {};
+
+  // the entry is left over when another command replaced this state before it was entered
+  ~RecordingScaleState() override {
+    delete this->recordingEntry;
+  }
 
   void enter(Scale *scale, ScaleState *prevState) override;
   bool update() override;
 
-  void render(JsonObject &state, bool isFull) const override;
+  void render(JsonWriter &writer, bool isFull) const override;
+  const char *getName() const override { return "recording"; }
+  bool isRecording() const override { return true; }
+  // the recorded data takes the place of the live measurement
+  bool rendersLiveData() const override { return false; }
+
+protected:
+  void renderRecording(JsonWriter &writer, bool isFull, bool isPaused) const;
 };
 
 class PausedRecordingScaleState : public RecordingScaleState {
@@ -80,7 +100,8 @@ class PausedRecordingScaleState : public RecordingScaleState {
 public:
   void enter(Scale *scale, ScaleState *prevState) override;
 
-  void render(JsonObject &state, bool isFull) const override;
+  void render(JsonWriter &writer, bool isFull) const override;
+  const char *getName() const override { return "pausedRecording"; }
 };
 
 class StopRecordingScaleState : public OnlineScaleState {
@@ -89,7 +110,8 @@ public:
   void enter(Scale *scale, ScaleState *prevState) override;
   bool update() override;
 
-  void render(JsonObject &state, bool isFull) const override;
+  void render(JsonWriter &writer, bool isFull) const override;
+  const char *getName() const override { return "stopRecording"; }
 };
 
 class TareScaleState : public OnlineScaleState {
@@ -99,7 +121,8 @@ public:
   bool update() override;
   void exit(ScaleState *nextState) override {};
 
-  void render(JsonObject &state, bool isFull) const override;
+  void render(JsonWriter &writer, bool isFull) const override;
+  const char *getName() const override { return "tare"; }
 };
 
 class CalibrateScaleState : public OnlineScaleState {
@@ -112,7 +135,8 @@ public:
   bool update() override;
   void exit(ScaleState *nextState) override {};
 
-  void render(JsonObject &state, bool isFull) const override;
+  void render(JsonWriter &writer, bool isFull) const override;
+  const char *getName() const override { return "calibrate"; }
 };
 
 class OfflineScaleState : public ScaleState {
@@ -122,7 +146,8 @@ public:
   bool update() override;
   void exit(ScaleState *nextState) override {};
 
-  void render(JsonObject &state, bool isFull) const override;
+  void render(JsonWriter &writer, bool isFull) const override;
+  const char *getName() const override { return "offline"; }
 };
 
 #endif
@@ -3,9 +3,14 @@
 
 #include <ArduinoJson.h>
 #include <ESPAsyncWebServer.h>
+#include <math.h>
 
-#include "catalog.h"
+#include "arena.h"
+#include "clock.h"
 #include "config.h"
+#include "heap_stats.h"
+#include "json_writer.h"
+#include "metrics.h"
 #include "persistent_config.h"
 #include "recorder.h"
 #include "scale.h"
@@ -13,28 +18,185 @@
 #define MAX_COMMAND_JSON_SIZE 512 // FIXME this will be too small for most realistic uploads - those can be as large as 16KB!
 #define MAX_ERROR_JSON_SIZE   128
 
+// Socket messages may hold a batch of commands, e.g. starting the recordings on four taps at once.
+// Their text is parsed in place, so the document only holds the structure of the batch.
+#define MAX_COMMAND_MESSAGE_SIZE    2048
+#define MAX_COMMAND_BATCH_JSON_SIZE 2048
+#define MAX_BATCH_COMMANDS          16
+// the response is sized by the number of results, each with room for an error message
+#define MAX_RESPONSE_JSON_SIZE 64
+#define MAX_RESULT_JSON_SIZE   160
+
+// a socket message received in parts, as it did not fit into a single TCP segment
+struct PendingCommandMessage {
+  uint32_t clientId;
+  char *data;
+  size_t length;
+};
+
 class Scales {
 
+  // the host benchmarks measure the renders directly
+  friend class ScalesBenchmark;
+
 private:
   std::vector<Scale*> scales;
   AsyncWebSocket socket;
 
+  // Full renders served to newly connected clients, built lazily for the states without live
+  // readings, and kept until the corresponding scale changes its state or records a new point.
+  std::vector<AsyncWebSocketMessageBuffer*> fullRenderCache;
+
+  std::vector<PendingCommandMessage> pendingMessages;
+
+  void renderScale(JsonWriter &writer, Scale *scale, bool isFullRender, time_t since) {
+    writer.beginObject();
+    writer.member("type", "data");
+    scale->render(writer, isFullRender, since);
+    writer.endObject();
+  }
+
+  // gives nullptr when there is no heap left for the render
+  AsyncWebSocketMessageBuffer *scaleToJson(Scale *scale, bool isFullRender, time_t since, bool isCached = false) {
+    // message buffers cannot be shrunk once allocated, so measure the exact size first
+    JsonWriter measure;
+    this->renderScale(measure, scale, isFullRender, since);
+    size_t len = measure.size();
+
+    // the cached full renders stay in the DRAM heap, as they would take most of the IRAM heap
+    AsyncWebSocketMessageBuffer *buffer = HeapStats.makeBuffer(this->socket, len, isCached);
+    if (buffer == nullptr) {
+      LOG_ERROR("[Scales] Unable to allocate %u bytes for a scale render.", (unsigned int) len);
+      return nullptr;
+    }
+    JsonWriter writer((char *) buffer->get(), len + 1);
+    this->renderScale(writer, scale, isFullRender, since);
+
+    return buffer;
+  }
+
   AsyncWebSocketMessageBuffer *scaleToJson(Scale *scale, bool isFullRender) {
-    MAKE_SCALE_JSON_DOC(doc);
-    doc["type"] = "data";
-    scale->render(doc, isFullRender);
-    size_t len = measureJson(doc);
-    AsyncWebSocketMessageBuffer *buffer = this->socket.makeBuffer(len);
-    serializeJson(doc, (char *) buffer->get(), len + 1);
+    time_t since = isFullRender ? 0 : Clock.now() - MAX_PARTIAL_RENDER_TIME_DELAY_SECONDS + 1;
+    return this->scaleToJson(scale, isFullRender, since);
+  }
+
+  AsyncWebSocketMessageBuffer *resumeToJson(Scale *scale, uint32_t recordingId, time_t since) {
+    if (!scale->canResume(recordingId, since)) {
+      return nullptr;
+    }
+
+    // include the recent points of regular partial renders as well
+    time_t partialSince = Clock.now() - MAX_PARTIAL_RENDER_TIME_DELAY_SECONDS + 1;
+    return this->scaleToJson(scale, false, since < partialSince ? since : partialSince);
+  }
+
+  // Reads the next "<recordingId>:<timestamp>" cursor from a comma separated list, where
+  // the position of the cursor is the scale index and empty items stand for no cursor.
+  bool parseResumeCursor(const char *&cursors, uint32_t &recordingId, time_t &since) {
+    char *end;
+    recordingId = strtoul(cursors, &end, 10);
+    bool isValid = end != cursors && *end == ':';
+    if (isValid) {
+      const char *sinceStart = end + 1;
+      since = strtol(sinceStart, &end, 10);
+      isValid = end != sinceStart;
+    }
+
+    const char *next = strchr(end, ',');
+    cursors = next != nullptr ? next + 1 : end + strlen(end);
+    return isValid;
+  }
+
+  void sendInitialRenders(AsyncWebServerRequest *request, AsyncWebSocketClient *client) {
+    AsyncWebParameter *resume = request->getParam("resume");
+    const char *cursors = resume != nullptr ? resume->value().c_str() : "";
+
+    for (size_t i = 0; i < this->scales.size(); ++i) {
+      AsyncWebSocketMessageBuffer *buffer = nullptr;
+      uint32_t recordingId;
+      time_t since;
+      if (this->parseResumeCursor(cursors, recordingId, since)) {
+        buffer = this->resumeToJson(this->scales[i], recordingId, since);
+      }
+      // fall back to a full render for unknown, outdated or changed recordings
+      if (buffer == nullptr) {
+        buffer = this->getFullRender(i);
+      }
+      if (buffer == nullptr) {
+        // the client gets the scale with its next change
+        continue;
+      }
+      client->text(buffer);
+      ++Metrics.websocketFramesSent;
+    }
+  }
+
+  AsyncWebSocketMessageBuffer *getFullRender(size_t index) {
+    Scale *scale = this->scales[index];
+    // e.g. the weight in standby changes without any update, so it is always rendered fresh
+    if (!scale->isRenderCacheable()) {
+      return this->scaleToJson(scale, true);
+    }
+
+    AsyncWebSocketMessageBuffer *buffer = this->fullRenderCache[index];
+    if (buffer == nullptr) {
+      buffer = this->scaleToJson(scale, true, 0, true);
+      if (buffer == nullptr) {
+        return nullptr;
+      }
+      // locked buffers are never freed by the socket, even without any queued messages
+      buffer->lock();
+      this->fullRenderCache[index] = buffer;
+    }
     return buffer;
   }
 
+  void invalidateFullRender(size_t index) {
+    AsyncWebSocketMessageBuffer *buffer = this->fullRenderCache[index];
+    if (buffer != nullptr) {
+      // the socket frees it with its next message to all clients once no queued message refers to it
+      buffer->unlock();
+      this->fullRenderCache[index] = nullptr;
+    }
+  }
+
+  void sendTo(AsyncWebSocketClient *client, AsyncWebSocketMessageBuffer *buffer) {
+    if (buffer != nullptr) {
+      client->text(buffer);
+    }
+  }
+
+  void sendToAll(AsyncWebSocketMessageBuffer *buffer) {
+    if (buffer == nullptr) {
+      return;
+    }
+    // the socket silently drops messages for clients with full queues
+    for (AsyncWebSocketClient *client : this->socket.getClients()) {
+      if (client->status() == WS_CONNECTED) {
+        if (client->queueIsFull()) {
+          ++Metrics.websocketFramesDropped;
+        } else {
+          ++Metrics.websocketFramesSent;
+        }
+      }
+    }
+    this->socket.textAll(buffer);
+  }
+
   AsyncWebSocketMessageBuffer *errorToJson(String &message) {
     StaticJsonDocument<MAX_ERROR_JSON_SIZE> doc;
     doc["type"] = "error";
     doc["message"] = message;
+    return this->responseToJson(doc);
+  }
+
+  AsyncWebSocketMessageBuffer *responseToJson(JsonDocument &doc) {
     size_t len = measureJson(doc);
-    AsyncWebSocketMessageBuffer *buffer = this->socket.makeBuffer(len);
+    AsyncWebSocketMessageBuffer *buffer = HeapStats.makeBuffer(this->socket, len);
+    if (buffer == nullptr) {
+      LOG_ERROR("[Scales] Unable to allocate %u bytes for a response.", (unsigned int) len);
+      return nullptr;
+    }
     serializeJson(doc, (char *) buffer->get(), len + 1);
     return buffer;
   }
@@ -43,16 +205,205 @@ private:
     return !command.isNull() && command.containsKey("action") && command.containsKey("index");
   }
 
-  void processCommand(JsonObject &command, AsyncWebSocketClient *client) {
+  void executeCommand(JsonObject command, JsonObject result) {
+    String errorMessage;
+    if (this->processCommand(command, errorMessage)) {
+      result["type"] = "ack";
+    } else {
+      LOG_ERROR("%s", errorMessage.c_str());
+      result["type"] = "error";
+      result["message"] = errorMessage;
+    }
+  }
+
+  // Messages contain either a single command, or a batch of them in a "commands" array.
+  // The optional "id" of the message is sent back in its response, so that clients
+  // can send multiple messages without waiting and match the responses later on.
+  void processMessage(JsonObject &message, AsyncWebSocketClient *client) {
+    bool isBatch = message.containsKey("commands");
+    JsonArray commands = message["commands"].as<JsonArray>();
+    if (isBatch && commands.size() > MAX_BATCH_COMMANDS) {
+      this->sendError(client, message, "[Scales] Too many commands in a batch, the limit is " + String(MAX_BATCH_COMMANDS) + ".");
+      return;
+    }
+
+    IramJsonDocument response(MAX_RESPONSE_JSON_SIZE + (isBatch ? commands.size() : 1) * MAX_RESULT_JSON_SIZE);
+    if (response.capacity() == 0) {
+      this->sendError(client, message, "[Scales] Unable to allocate the response of the commands.");
+      return;
+    }
+    JsonObject obj = response.to<JsonObject>();
+    // first, so that it is there even when the results do not fit
+    if (message.containsKey("id")) {
+      obj["id"] = message["id"];
+    }
+
+    if (isBatch) {
+      obj["type"] = "results";
+      JsonArray results = obj.createNestedArray("results");
+      for (JsonVariant command : commands) {
+        this->executeCommand(command.as<JsonObject>(), results.createNestedObject());
+      }
+    } else {
+      this->executeCommand(message, obj);
+    }
+
+    if (response.overflowed()) {
+      // the commands ran, only their results are lost
+      this->sendError(client, message, "[Scales] The results of the commands do not fit into the response.");
+      return;
+    }
+    this->sendTo(client, this->responseToJson(response));
+  }
+
+  void sendError(AsyncWebSocketClient *client, JsonObject &message, String errorMessage) {
+    LOG_ERROR("%s", errorMessage.c_str());
+    StaticJsonDocument<MAX_ERROR_JSON_SIZE> doc;
+    if (message.containsKey("id")) {
+      doc["id"] = message["id"];
+    }
+    doc["type"] = "error";
+    doc["message"] = errorMessage;
+    this->sendTo(client, this->responseToJson(doc));
+  }
+
+  void processPayload(AsyncWebSocketClient *client, char *payload, size_t len) {
+    // parsed in place, the strings of the document point into the payload
+    IramJsonDocument doc(MAX_COMMAND_BATCH_JSON_SIZE);
+    if (doc.capacity() == 0) {
+      String message = "[Scales] Unable to allocate scale command document.";
+      LOG_ERROR("%s", message.c_str());
+      this->sendTo(client, this->errorToJson(message));
+      return;
+    }
+    DeserializationError error = deserializeJson(doc, payload, len);
+    if (error) {
+      String message = "[Scales] Unable to deserialize scale command payload: " + String(error.c_str());
+      LOG_ERROR("%s", message.c_str());
+      this->sendTo(client, this->errorToJson(message));
+      return;
+    }
+
+    JsonObject message = doc.as<JsonObject>();
+    if (message.isNull()) {
+      String errorMessage = "[Scales] Invalid scale command format.";
+      LOG_ERROR("%s", errorMessage.c_str());
+      this->sendTo(client, this->errorToJson(errorMessage));
+      return;
+    }
+
+    this->processMessage(message, client);
+  }
+
+  PendingCommandMessage *findPendingMessage(uint32_t clientId) {
+    for (PendingCommandMessage &pending : this->pendingMessages) {
+      if (pending.clientId == clientId) {
+        return &pending;
+      }
+    }
+    return nullptr;
+  }
+
+  void dropPendingMessage(uint32_t clientId) {
+    for (size_t i = 0; i < this->pendingMessages.size(); ++i) {
+      PendingCommandMessage &pending = this->pendingMessages[i];
+      if (pending.clientId == clientId) {
+        free(pending.data);
+        HeapStats.remove(HeapTag::WebRequests, pending.length + 1);
+        this->pendingMessages.erase(this->pendingMessages.begin() + i);
+        return;
+      }
+    }
+  }
+
+  // Messages larger than a TCP segment arrive in parts of the same frame, which are collected per
+  // client up to MAX_COMMAND_MESSAGE_SIZE. Messages fragmented into several frames are not supported.
+  void receiveMessage(AsyncWebSocketClient *client, AwsFrameInfo *info, char *data, size_t len) {
+    if (!info->final || info->num > 0) {
+      String message = "[Scales] Ignoring multi-frame scale command payload.";
+      LOG_ERROR("%s", message.c_str());
+      this->sendTo(client, this->errorToJson(message));
+      return;
+    }
+    if (info->len > MAX_COMMAND_MESSAGE_SIZE || info->index + len > info->len) {
+      if (info->index == 0) {
+        String message = "[Scales] Scale command payload is larger than " + String(MAX_COMMAND_MESSAGE_SIZE) + " bytes.";
+        LOG_ERROR("%s", message.c_str());
+        this->sendTo(client, this->errorToJson(message));
+      }
+      return;
+    }
+
+    if (info->index == 0 && len == info->len) {
+      // the library leaves room for terminating the payload
+      data[len] = 0;
+      this->processPayload(client, data, len);
+      return;
+    }
+
+    if (info->index == 0) {
+      this->dropPendingMessage(client->id());
+      PendingCommandMessage pending = {client->id(), (char *) malloc(info->len + 1), (size_t) info->len};
+      if (pending.data == nullptr) {
+        String message = "[Scales] Unable to allocate scale command payload.";
+        LOG_ERROR("%s", message.c_str());
+        this->sendTo(client, this->errorToJson(message));
+        return;
+      }
+      HeapStats.add(HeapTag::WebRequests, pending.length + 1);
+      this->pendingMessages.push_back(pending);
+    }
+
+    // the parts without a beginning are dropped, it was answered with an error already
+    PendingCommandMessage *pending = this->findPendingMessage(client->id());
+    if (pending == nullptr || pending->length != info->len) {
+      return;
+    }
+    memcpy(pending->data + info->index, data, len);
+    if (info->index + len == info->len) {
+      pending->data[pending->length] = 0;
+      this->processPayload(client, pending->data, pending->length);
+      this->dropPendingMessage(client->id());
+    }
+  }
+
+public:
+
+  Scales() : socket("/scales") {
+    this->socket.onEvent([this](AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+      if (type == WS_EVT_CONNECT) {
+        // the upgrade request is passed on connect, so clients can ask to resume through its parameters
+        this->sendInitialRenders((AsyncWebServerRequest *) arg, client);
+      } else if (type == WS_EVT_DATA) {
+        this->receiveMessage(client, (AwsFrameInfo *) arg, (char *) data, len);
+      } else if (type == WS_EVT_DISCONNECT) {
+        this->dropPendingMessage(client->id());
+      }
+    });
+  }
+
+  // Validates and executes a single command, that is shared by the socket and the REST API.
+  // Commands only set the next state of the scale, which takes effect in the next loop,
+  // so a scale takes a single command per loop and rejects the others meanwhile.
+  bool processCommand(JsonObject &command, String &errorMessage) {
+    if (!this->isCommandValid(command)) {
+      errorMessage = "[Scales] Invalid scale command format.";
+      return false;
+    }
+
     String action = command["action"];
     size_t index = command["index"];
-    Scale *scale = this->scales[index];
 
-    if (index < 0 || index >= this->scales.size()) {
-      String message = "[Scales] Invalid scale index in command: " + String(index);
-      Logger.print(message);
-      client->text(this->errorToJson(message));
-      return;
+    if (index >= this->scales.size()) {
+      errorMessage = "[Scales] Invalid scale index in command: " + String(index);
+      return false;
+    }
+
+    Scale *scale = this->scales[index];
+    // a later command would silently replace the state set by the previous one
+    if (scale->hasPendingState()) {
+      errorMessage = "[Scales] Previous command of scale " + String(index) + " is still pending.";
+      return false;
     }
 
     if (action == "standby") {
@@ -63,13 +414,27 @@ private:
       scale->tare();
     } else if (action == "calibrate") {
       float knownMass = command["knownMass"];
+      // the calibration factor would be infinite or NaN otherwise
+      if (!isfinite(knownMass) || knownMass <= 0) {
+        errorMessage = "[Scales] Invalid known mass for calibration of scale " + String(index);
+        return false;
+      }
       scale->calibrate(knownMass);
     } else if (action == "startRecording") {
-      TapEntry *tapEntry = TapEntry::fromJson(command["tapEntry"].as<JsonObject>());
-      scale->startRecording(tapEntry);
+      // parsed right into the recording, which the recorder keeps
+      RecordingEntry *newEntry = RecordingEntry::forTapEntry(command["tapEntry"].as<JsonObject>());
+      if (newEntry == nullptr) {
+        errorMessage = "[Scales] Unable to allocate recording for scale " + String(index);
+        return false;
+      }
+      scale->startRecording(newEntry);
     } else if (action == "putRecordingEntry") {
       RecordingEntry *recordingEntry = RecordingEntry::fromJson(command["recordingEntry"].as<JsonObject>());
-      scale->startRecording(recordingEntry);
+      if (recordingEntry == nullptr) {
+        errorMessage = "[Scales] Unable to allocate recording for scale " + String(index);
+        return false;
+      }
+      scale->restoreRecording(recordingEntry);
     } else if (action == "pauseRecording") {
       scale->pauseRecording();
     } else if (action == "continueRecording") {
@@ -77,56 +442,11 @@ private:
     } else if (action == "stopRecording") {
       scale->stopRecording();
     } else {
-      String message = "[Scales] Unknown scale command action: " + action;
-      Logger.print(message);
-      client->text(this->errorToJson(message));
-      return;
+      errorMessage = "[Scales] Unknown scale command action: " + action;
+      return false;
     }
 
-    client->text("{\"type\":\"ack\"}");
-  }
-
-public:
-
-  Scales() : socket("/scales") {
-    this->socket.onEvent([this](AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
-      if (type == WS_EVT_CONNECT) {
-        for (Scale *scale : this->scales) {
-          client->text(this->scaleToJson(scale, true));
-        }
-      } else if (type == WS_EVT_DATA) {
-        AwsFrameInfo *info = (AwsFrameInfo *) arg;
-        // FIXME for large uploads we'd need to support multi-frame messages?
-        // it seems that up to 528 bytes the messages are single-frame
-        if (info->final && info->index == 0 && info->len == len) {
-          char *payload = (char *) data;
-          payload[len] = 0;
-
-          StaticJsonDocument<MAX_COMMAND_JSON_SIZE> doc;
-          DeserializationError error = deserializeJson(doc, payload, len);
-          if (error) {
-            String message = "[Scales] Unable to deserialize scale command payload: " + String(payload);
-            Logger.print(message);
-            client->text(this->errorToJson(message));
-            return;
-          }
-
-          JsonObject command = doc.as<JsonObject>();
-          if (!this->isCommandValid(command)) {
-            String message = "[Scales] Invalid scale command format: " + String(payload);
-            Logger.print(message);
-            client->text(this->errorToJson(message));
-            return;
-          }
-
-          this->processCommand(command, client);
-        } else {
-          String message = "[Scales] Ignoring multi-frame scale command payload.";
-          Logger.print(message);
-          client->text(this->errorToJson(message));
-        }
-      }
-    });
+    return true;
   }
 
   AsyncWebSocket* getSocket() {
@@ -137,6 +457,7 @@ public:
     for (size_t i = 0; i < config.scales.size(); ++i) {
       Scale *scale = new Scale(i, config.scales[i], persistentConfig.getCalibrationForScale(i), recorder);
       this->scales.push_back(scale);
+      this->fullRenderCache.push_back(nullptr);
       scale->begin();
     }
   }
@@ -144,11 +465,13 @@ public:
   void handle() {
     this->socket.cleanupClients();
     yield();
-    for (Scale *scale : this->scales) {
+    for (size_t i = 0; i < this->scales.size(); ++i) {
+      Scale *scale = this->scales[i];
       UpdateResult result = scale->update();
       if (result != UpdateResult::None) {
+        this->invalidateFullRender(i);
         bool isFullRender = result == UpdateResult::StateChange;
-        this->socket.textAll(this->scaleToJson(scale, isFullRender));
+        this->sendToAll(this->scaleToJson(scale, isFullRender));
       }
       yield();
     }
@@ -12,6 +12,18 @@
 #include <LittleFS.h>
 #include <umm_malloc/umm_heap_select.h>
 
+#include "arena.h"
+#include "cached_json_response.h"
+#include "clock.h"
+#include "crash_trace.h"
+#include "heap_stats.h"
+#include "metrics.h"
+#include "profiler.h"
+
+#define MAX_CONFIG_JSON_SIZE 1536
+#define MAX_CATALOG_SUMMARY_JSON_SIZE 512
+#define MAX_CATALOG_ENTRY_JSON_SIZE 384
+
 const char compiledAt[] = COMPILED_AT;
 
 class WebServer {
@@ -24,35 +36,68 @@ class WebServer {
 
   AsyncWebServer server;
 
+  // the body of a scale command, of a single request at a time, instead of an allocation per request
+  char commandBody[MAX_COMMAND_JSON_SIZE + 1];
+  AsyncWebServerRequest *commandBodyRequest;
+
+  CachedJsonResponse configResponse;
+  CachedJsonResponse persistentConfigResponse;
+  uint32_t persistentConfigRevision;
+
   void addRootHandler() {
+    // bundles are named after their content hash, hence they never change under the same name
+    this->server
+      .serveStatic("/static/", LittleFS, "/html/static/")
+      .setCacheControl("public, max-age=31536000, immutable");
+    // whereas index.html refers to the current bundles, so it always has to be revalidated
     this->server
       .serveStatic("/", LittleFS, "/html/")
       .setLastModified(config.fsLastModified)
+      .setCacheControl("no-cache")
       .setDefaultFile("index.html");
   }
 
   void addConfigHandler() {
+    {
+      // the configuration does not change after boot
+      IramJsonDocument doc(MAX_CONFIG_JSON_SIZE);
+      if (doc.capacity() > 0) {
+        this->config.render(doc);
+        this->configResponse.update(doc);
+      }
+    }
+
     this->server.on("/config", HTTP_GET, [this](AsyncWebServerRequest *request) {
-      AsyncResponseStream *response = request->beginResponseStream("application/json");
-      DynamicJsonDocument doc(1536);
-      this->config.render(doc);
-      serializeJson(doc, *response);
-      request->send(response);
+      if (this->configResponse.isEmpty()) {
+        request->send(503, "text/plain", "Out of memory.");
+        return;
+      }
+      this->configResponse.send(request);
     });
   }
 
   void addPersistentConfigHandler() {
     this->server.on("/persistent-config", HTTP_GET, [this](AsyncWebServerRequest *request) {
-      AsyncResponseStream *response = request->beginResponseStream("application/json");
-      DynamicJsonDocument doc(1536);
-      this->persistentConfig.render(doc);
-      serializeJson(doc, *response);
-      request->send(response);
+      // render again only after the persistent configuration was saved
+      uint32_t revision = this->persistentConfig.getRevision();
+      if (this->persistentConfigResponse.isEmpty() || revision != this->persistentConfigRevision) {
+        IramJsonDocument doc(MAX_CONFIG_JSON_SIZE);
+        if (doc.capacity() == 0) {
+          // never cache an empty document under a valid ETag
+          request->send(503, "text/plain", "Out of memory.");
+          return;
+        }
+        this->persistentConfig.render(doc);
+        this->persistentConfigResponse.update(doc);
+        this->persistentConfigRevision = revision;
+      }
+      this->persistentConfigResponse.send(request);
     });
   }
 
   void addPersistHandler() {
     this->server.on("/persist", HTTP_POST, [this](AsyncWebServerRequest *request) {
+      // committed right away, so that the UI learns whether it failed; unchanged calibrations are not written again
       if (this->persistentConfig.save()) {
         request->send(200, "text/plain", "ok");
       } else {
@@ -64,23 +109,45 @@ class WebServer {
   void addCatalogHandlers() {
     this->server.on("/catalog", HTTP_GET, [this](AsyncWebServerRequest *request) {
       AsyncResponseStream *response = request->beginResponseStream("application/json");
-      DynamicJsonDocument doc(2048);
+      StaticJsonDocument<MAX_CATALOG_SUMMARY_JSON_SIZE> doc;
       doc["lastRefresh"] = DateFormatter::format(DateFormatter::SIMPLE, this->catalog.getLastRefresh());
       doc["lastStatusCode"] = this->catalog.getLastStatusCode();
       doc["lastErrorMessage"] = this->catalog.getLastErrorMessage();
+      doc["isTruncated"] = this->catalog.getIsTruncated();
+
+      JsonObject refresh = doc.createNestedObject("refresh");
+      refresh["state"] = this->catalog.getRefreshStateName();
+      refresh["lastHandshakeMillis"] = this->catalog.getLastHandshakeMillis();
+      refresh["lastTransferMillis"] = this->catalog.getLastTransferMillis();
+      if (this->catalog.getRefreshState() != CatalogRefreshState::Idle) {
+        refresh["bytesRead"] = this->catalog.getRefreshBytesRead();
+        refresh["entriesParsed"] = this->catalog.getRefreshEntriesParsed();
+        refresh["pages"] = this->catalog.getRefreshPages();
+      }
 
-      JsonArray entries = doc.createNestedArray("entries");
+      // the entries are rendered one at a time, so the documents do not grow with the catalog
+      char summary[MAX_CATALOG_SUMMARY_JSON_SIZE];
+      size_t summaryLength = serializeJson(doc, summary, sizeof(summary));
+      response->write((const uint8_t *) summary, summaryLength - 1);
+      response->print(",\"entries\":[");
+      bool isFirst = true;
       for (CatalogEntry &entry : this->catalog.getEntries()) {
-        JsonObject obj = entries.createNestedObject();
+        if (!isFirst) {
+          response->print(",");
+        }
+        isFirst = false;
+        StaticJsonDocument<MAX_CATALOG_ENTRY_JSON_SIZE> entryDoc;
+        JsonObject obj = entryDoc.to<JsonObject>();
         entry.render(obj);
+        serializeJson(entryDoc, *response);
       }
-
-      serializeJson(doc, *response);
+      response->print("]}");
       request->send(response);
     });
     this->server.on("/catalog/update", HTTP_POST, [this](AsyncWebServerRequest *request) {
+      // the update runs in the background, clients can follow it through the refresh state of /catalog
       this->catalog.update();
-      request->send(200, "text/plain", "ok");
+      request->send(202, "text/plain", "ok");
     });
   }
 
@@ -88,10 +155,136 @@ class WebServer {
     this->server.addHandler(this->scales.getSocket());
   }
 
+  void addScaleCommandHandler() {
+    // handles POST /scales/{index}/{action}, with the optional parameters of the command in a JSON or form encoded body
+    this->server.on("/scales", HTTP_POST, [this](AsyncWebServerRequest *request) {
+      unsigned int index;
+      char action[32];
+      if (sscanf(request->url().c_str(), "/scales/%u/%31s", &index, action) != 2) {
+        request->send(404);
+        return;
+      }
+
+      if (request->contentLength() > MAX_COMMAND_JSON_SIZE) {
+        this->sendCommandResponse(request, 413, "[WebServer] Scale command parameters are too large.");
+        return;
+      }
+
+      // the library parses form encoded bodies into parameters itself, all others are passed as they are
+      bool isJsonBody = request->contentType().startsWith("application/json");
+      bool isFormBody = request->contentType().startsWith("application/x-www-form-urlencoded");
+      if (request->contentLength() > 0 && !isJsonBody && !isFormBody) {
+        this->sendCommandResponse(request, 415, "[WebServer] Scale command parameters have to be JSON or form encoded.");
+        return;
+      }
+
+      StaticJsonDocument<MAX_COMMAND_JSON_SIZE> doc;
+      JsonObject command;
+      if (isJsonBody && request->contentLength() > 0) {
+        if (this->commandBodyRequest != request) {
+          this->sendCommandResponse(request, 503, "[WebServer] Another scale command is being received.");
+          return;
+        }
+        // no other body arrives before this handler returns, so the buffer is free for the next one
+        this->commandBodyRequest = nullptr;
+        DeserializationError error = deserializeJson(doc, this->commandBody);
+        if (error) {
+          this->sendCommandResponse(request, 400, "[WebServer] Unable to deserialize scale command parameters.");
+          return;
+        }
+        command = doc.as<JsonObject>();
+      } else {
+        command = doc.to<JsonObject>();
+        for (size_t i = 0; i < request->params(); ++i) {
+          AsyncWebParameter *param = request->getParam(i);
+          if (param->isPost()) {
+            // numbers are parsed from their strings when the command reads them
+            command[param->name()] = param->value();
+          }
+        }
+        if (doc.overflowed()) {
+          this->sendCommandResponse(request, 413, "[WebServer] Scale command parameters are too large.");
+          return;
+        }
+      }
+
+      if (command.isNull()) {
+        this->sendCommandResponse(request, 400, "[WebServer] Invalid scale command parameters.");
+        return;
+      }
+      command["action"] = (const char *) action;
+      command["index"] = index;
+
+      String errorMessage;
+      if (this->scales.processCommand(command, errorMessage)) {
+        this->sendCommandResponse(request, 200, nullptr);
+      } else {
+        LOG_ERROR("%s", errorMessage.c_str());
+        this->sendCommandResponse(request, 400, errorMessage.c_str());
+      }
+    }, nullptr, [this](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+      if (total > MAX_COMMAND_JSON_SIZE) {
+        // rejected by the request handler
+        return;
+      }
+      if (index == 0) {
+        if (this->commandBodyRequest != nullptr) {
+          // rejected by the request handler, as the body of another request is still arriving
+          return;
+        }
+        this->commandBodyRequest = request;
+        request->onDisconnect([this, request]() {
+          if (this->commandBodyRequest == request) {
+            this->commandBodyRequest = nullptr;
+          }
+        });
+      }
+      if (this->commandBodyRequest == request) {
+        memcpy(this->commandBody + index, data, len);
+        this->commandBody[index + len] = 0;
+      }
+    });
+  }
+
+  void sendCommandResponse(AsyncWebServerRequest *request, int code, const char *errorMessage) {
+    StaticJsonDocument<MAX_ERROR_JSON_SIZE> doc;
+    if (errorMessage == nullptr) {
+      doc["type"] = "ack";
+    } else {
+      doc["type"] = "error";
+      doc["message"] = errorMessage;
+    }
+    AsyncResponseStream *response = request->beginResponseStream("application/json");
+    response->setCode(code);
+    serializeJson(doc, *response);
+    request->send(response);
+  }
+
   void addStatusHandler() {
+    // registered first, as the general status handler would also match their paths
+    this->server.on("/status/last-crash", HTTP_GET, [this](AsyncWebServerRequest *request) {
+      AsyncResponseStream *response = request->beginResponseStream("application/json");
+      IramJsonDocument doc(1536);
+      CrashTrace.render(doc);
+      serializeJson(doc, *response);
+      request->send(response);
+    });
+
+    this->server.on("/status/perf", HTTP_GET, [this](AsyncWebServerRequest *request) {
+#ifdef ENABLE_LOOP_PROFILER
+      AsyncResponseStream *response = request->beginResponseStream("application/json");
+      IramJsonDocument doc(3072);
+      Profiler.render(doc);
+      serializeJson(doc, *response);
+      request->send(response);
+#else
+      request->send(404, "text/plain", "Loop profiler is not enabled.");
+#endif
+    });
+
     this->server.on("/status", HTTP_GET, [this](AsyncWebServerRequest *request) {
       AsyncResponseStream *response = request->beginResponseStream("application/json");
-      DynamicJsonDocument doc(768);
+      IramJsonDocument doc(1536);
       JsonObject general = doc.createNestedObject("general");
       general["compiledAt"] = compiledAt;
       general["fsLastModified"] = config.fsLastModified;
@@ -106,13 +299,19 @@ class WebServer {
       {
         HeapSelectDram ephemeral;
         heap["freeDramHeap"] = ESP.getFreeHeap();
+        heap["maxFreeDramBlock"] = ESP.getMaxFreeBlockSize();
         heap["dramHeapFragmentation"] = ESP.getHeapFragmentation();
       }
       {
         HeapSelectIram ephemeral;
         heap["freeIramHeap"] = ESP.getFreeHeap();
+        heap["maxFreeIramBlock"] = ESP.getMaxFreeBlockSize();
         heap["iramHeapFragmentation"] = ESP.getHeapFragmentation();
       }
+      HeapStats.renderFreeHeaps(heap);
+
+      HeapStats.render(doc.createNestedObject("heapUsage"));
+      SlotArena::renderAll(doc.createNestedObject("arenas"));
 
       JsonObject eeprom = doc.createNestedObject("eeprom");
       eeprom["percentUsed"] = EEPROM.percentUsed();
@@ -138,13 +337,61 @@ class WebServer {
     });
   }
 
+  void addMetricsHandler() {
+    this->server.on("/metrics", HTTP_GET, [this](AsyncWebServerRequest *request) {
+      AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4");
+      Metrics.render(*response);
+
+      Metrics.printMetric(*response, "keg_scale_websocket_clients", "gauge", "Connected scale socket clients.", this->scales.getSocket()->count());
+      Metrics.printMetric(*response, "keg_scale_log_clients", "gauge", "Connected log socket clients.", Logger.getSocket()->count());
+
+      uint32_t freeDramHeap, dramHeapFragmentation, freeIramHeap, iramHeapFragmentation;
+      {
+        HeapSelectDram ephemeral;
+        freeDramHeap = ESP.getFreeHeap();
+        dramHeapFragmentation = ESP.getHeapFragmentation();
+      }
+      {
+        HeapSelectIram ephemeral;
+        freeIramHeap = ESP.getFreeHeap();
+        iramHeapFragmentation = ESP.getHeapFragmentation();
+      }
+      Metrics.printHeader(*response, "keg_scale_heap_free_bytes", "gauge", "Free heap.");
+      response->printf("keg_scale_heap_free_bytes{heap=\"dram\"} %u\n", freeDramHeap);
+      response->printf("keg_scale_heap_free_bytes{heap=\"iram\"} %u\n", freeIramHeap);
+      Metrics.printHeader(*response, "keg_scale_heap_fragmentation_percent", "gauge", "Heap fragmentation.");
+      response->printf("keg_scale_heap_fragmentation_percent{heap=\"dram\"} %u\n", dramHeapFragmentation);
+      response->printf("keg_scale_heap_fragmentation_percent{heap=\"iram\"} %u\n", iramHeapFragmentation);
+
+      // millis() wraps after about 49 days, which would look like a counter reset
+      Metrics.printMetric(*response, "keg_scale_uptime_seconds", "counter", "Time since boot.", (uint32_t) (Clock.monotonicMillis() / 1000));
+
+      request->send(response);
+    });
+  }
+
   void addLogHandler() {
+    // sets the runtime log level by its name, e.g. POST /log/level?level=debug
+    this->server.on("/log/level", HTTP_POST, [](AsyncWebServerRequest *request) {
+      static const char *levelNames[] = {"error", "warning", "info", "debug"};
+      AsyncWebParameter *level = request->getParam("level");
+      if (level != nullptr) {
+        for (uint8_t i = 0; i <= LOG_COMPILED_LEVEL; ++i) {
+          if (level->value() == levelNames[i]) {
+            Logger.setLevel(i);
+            request->send(200, "text/plain", "ok");
+            return;
+          }
+        }
+      }
+      request->send(400, "text/plain", "Unknown log level.");
+    });
     this->server.addHandler(Logger.getSocket());
   }
 
 public:
   WebServer(Config &_config, PersistentConfig &_persistentConfig, BrewfatherCatalog &_catalog, Scales &_scales, Recorder &_recorder) :
-    config(_config), persistentConfig(_persistentConfig), catalog(_catalog), scales(_scales), recorder(_recorder), server(_config.httpPort) {
+    config(_config), persistentConfig(_persistentConfig), catalog(_catalog), scales(_scales), recorder(_recorder), server(_config.httpPort), commandBodyRequest(nullptr), persistentConfigRevision(0) {
     MDNS.addService("http", "tcp", this->config.httpPort);
   }
 
@@ -155,7 +402,9 @@ public:
     this->addPersistHandler();
     this->addCatalogHandlers();
     this->addScalesHandler();
+    this->addScaleCommandHandler();
     this->addStatusHandler();
+    this->addMetricsHandler();
     this->addLogHandler();
     // makes local testing of web ui easier
     DefaultHeaders::Instance().addHeader("Access-Control-Allow-Origin", "*");
@@ -0,0 +1,70 @@
+#ifndef KEG_SCALE__WIFI_CONNECTION_H
+#define KEG_SCALE__WIFI_CONNECTION_H
+
+#include <ESP8266WiFi.h>
+#include <vector>
+
+#include "config.h"
+
+#define WIFI_CACHE_PATH                  "/wifi.bin"
+#define WIFI_CACHE_MAGIC                 0x4b535746
+#define WIFI_FAST_CONNECT_TIMEOUT_MILLIS 5000
+#define WIFI_CONNECT_TIMEOUT_MILLIS      10000
+#define WIFI_SCAN_TIMEOUT_MILLIS         10000
+// the core reconnects on its own for this long, before the other networks are tried
+#define WIFI_RECONNECT_TIMEOUT_MILLIS    30000
+
+enum class WiFiConnectionState {
+  FastConnecting,
+  Scanning,
+  Connecting,
+  Connected
+};
+
+// The access point of the last connection, which is joined again without a scan.
+struct WiFiCache {
+  uint32_t magic;
+  char ssid[64];
+  uint8_t bssid[6];
+  int32_t channel;
+};
+
+struct WiFiCandidate {
+  size_t wifiIndex;
+  uint8_t bssid[6];
+  int32_t channel;
+  int32_t rssi;
+};
+
+// Connects to one of the configured networks in the background, so that the scales do not wait for it.
+// The access point of the last connection is tried first, then the configured networks found by a scan,
+// the strongest first. A connection lost for long is replaced by the next best network the same way.
+class WiFiConnection {
+
+private:
+  const std::vector<WiFiConfig> *wifis;
+  WiFiConnectionState state;
+  uint32_t stepStartMillis;
+  WiFiCache cache;
+  std::vector<WiFiCandidate> candidates;
+  size_t nextCandidate;
+
+  int findWifi(const char *ssid);
+  void setState(WiFiConnectionState newState);
+  void startScan();
+  void readScan();
+  void connectNext();
+  void finishConnect();
+
+public:
+  WiFiConnection() : wifis(nullptr), state(WiFiConnectionState::Scanning), stepStartMillis(0), nextCandidate(0) {};
+
+  void begin(const std::vector<WiFiConfig> &_wifis);
+  void handle();
+
+  bool isConnected() {
+    return this->state == WiFiConnectionState::Connected && WiFi.status() == WL_CONNECTED;
+  }
+};
+
+#endif
@@ -0,0 +1,97 @@
+#include "arena.h"
+#include "logger.h"
+
+SlotArena *SlotArena::first = nullptr;
+
+SlotArena::SlotArena(const char *_name, HeapTag _tag, size_t _slotSize)
+  : name(_name)
+  , tag(_tag)
+  , slotSize((_slotSize + 3) & ~3)
+  , numSlots(0)
+  , block(nullptr)
+  , usedSlots(0)
+  , numUsedSlots(0)
+  , peakUsedSlots(0)
+  , numFallbacks(0)
+  , next(SlotArena::first) {
+  SlotArena::first = this;
+}
+
+void SlotArena::begin(size_t _numSlots) {
+  if (this->block != nullptr) {
+    return;
+  }
+  if (_numSlots > ARENA_MAX_SLOTS) {
+    _numSlots = ARENA_MAX_SLOTS;
+  }
+
+  HeapSelectIram ephemeral;
+  this->block = (uint8_t *) malloc(this->slotSize * _numSlots);
+  if (this->block == nullptr) {
+    LOG_ERROR("[Arena] Unable to reserve %u slots for %s.", (unsigned int) _numSlots, this->name);
+    return;
+  }
+  this->numSlots = _numSlots;
+  HeapStats.add(this->tag, this->slotSize * _numSlots);
+}
+
+void *SlotArena::allocate(size_t size) {
+  if (size <= this->slotSize) {
+    for (size_t i = 0; i < this->numSlots; ++i) {
+      if (!(this->usedSlots & (1ul << i))) {
+        this->usedSlots |= 1ul << i;
+        ++this->numUsedSlots;
+        if (this->numUsedSlots > this->peakUsedSlots) {
+          this->peakUsedSlots = this->numUsedSlots;
+        }
+        return this->block + i * this->slotSize;
+      }
+    }
+  }
+
+  ++this->numFallbacks;
+  void *ptr;
+  {
+    HeapSelectIram ephemeral;
+    ptr = malloc(size);
+  }
+  if (ptr == nullptr) {
+    HeapSelectDram ephemeral;
+    ptr = malloc(size);
+  }
+  if (ptr != nullptr) {
+    HeapStats.add(this->tag, size);
+  }
+  return ptr;
+}
+
+void SlotArena::deallocate(void *ptr, size_t size) {
+  if (ptr == nullptr) {
+    return;
+  }
+  if (!this->isInBlock(ptr)) {
+    // the heap is told by the address
+    free(ptr);
+    HeapStats.remove(this->tag, size);
+    return;
+  }
+
+  size_t i = ((uint8_t *) ptr - this->block) / this->slotSize;
+  this->usedSlots &= ~(1ul << i);
+  --this->numUsedSlots;
+}
+
+void SlotArena::render(JsonObject obj) const {
+  obj["slotSize"] = this->slotSize;
+  obj["numSlots"] = this->numSlots;
+  obj["usedSlots"] = this->numUsedSlots;
+  obj["peakUsedSlots"] = this->peakUsedSlots;
+  obj["freeBytes"] = (this->numSlots - this->numUsedSlots) * this->slotSize;
+  obj["fallbacks"] = this->numFallbacks;
+}
+
+void SlotArena::renderAll(JsonObject obj) {
+  for (SlotArena *arena = SlotArena::first; arena != nullptr; arena = arena->next) {
+    arena->render(obj.createNestedObject(arena->name));
+  }
+}
@@ -0,0 +1,668 @@
+#include "catalog.h"
+
+BrewfatherCatalog::BrewfatherCatalog()
+  : client(nullptr)
+  , isMFLProbed(false)
+  , useMFL(false)
+  , tlsBufferSize(0)
+  , lastStatusCode(0)
+  , config(nullptr)
+  , lastRefresh(0)
+  , nextRefresh(0)
+  , isTruncated(false)
+  , isUpdateRequested(false)
+  , state(CatalogRefreshState::Idle)
+  , refreshStartMillis(0)
+  , stepStartMillis(0)
+  , bytesRead(0)
+  , numPages(0)
+  , numEntriesParsed(0)
+  , connectStartMillis(0)
+  , requestStartMillis(0)
+  , handshakeMillis(0)
+  , transferMillis(0)
+  , numHandshakes(0)
+  , numRequests(0)
+  , lastHandshakeMillis(0)
+  , lastTransferMillis(0)
+  , lineLength(0)
+  , responseStatusCode(0)
+  , responseHash(0)
+  , isConnectionReusable(false)
+  , isChunked(false)
+  , bodyRemaining(-1)
+  , chunkState(ChunkState::Size)
+  , chunkRemaining(0)
+  , isChunkExtension(false)
+  , trailerLineLength(0)
+  , isBodyDone(false)
+  , contentHash(0)
+  , entryBuffer(nullptr)
+  , entryLength(0)
+  , depth(0)
+  , isInString(false)
+  , isEscaped(false)
+  , isArrayStarted(false)
+  , isArrayDone(false) {
+  this->responseEtag[0] = 0;
+  this->etag[0] = 0;
+  this->startAfter[0] = 0;
+}
+
+void BrewfatherCatalog::begin(BrewfatherCatalogConfig *_config, BearSSL::WiFiClientSecure *_client) {
+  this->config = _config;
+  this->client = _client;
+  this->client->setSession(&this->session);
+  this->lastStatusCode = 0;
+  this->lastErrorMessage = String("");
+  this->lastRefresh = 0;
+  this->nextRefresh = 0;
+  this->entries.clear();
+  // the cached entries are available right away, and they are refreshed in the background once due
+  this->loadCache();
+
+  // only the fields of CatalogEntry are kept from each batch
+  this->filter["_id"] = true;
+  this->filter["batchNo"] = true;
+  this->filter["recipe"]["name"] = true;
+  this->filter["recipe"]["color"] = true;
+  this->filter["bottlingDate"] = true;
+  this->filter["measuredBottlingSize"] = true;
+  this->filter["measuredFg"] = true;
+  this->filter["measuredAbv"] = true;
+}
+
+void BrewfatherCatalog::update() {
+  // the next update will start in the loop, unless one is already in progress
+  this->isUpdateRequested = true;
+}
+
+void BrewfatherCatalog::handle() {
+  HeapSelectIram ephemeral;
+
+  if (this->state != CatalogRefreshState::Idle && millis() - this->stepStartMillis > CATALOG_STEP_TIMEOUT_MILLIS) {
+    this->failRefresh(HTTPC_ERROR_READ_TIMEOUT, "Catalog update timed out.");
+    return;
+  }
+
+  switch (this->state) {
+    case CatalogRefreshState::Idle:
+      // waits for the network and for the time, which the refreshes are scheduled by
+      if (WiFi.status() != WL_CONNECTED || !Clock.isValid()) {
+        break;
+      }
+      if (this->isUpdateRequested || Clock.now() >= this->nextRefresh) {
+        this->startRefresh();
+      }
+      break;
+    case CatalogRefreshState::Connecting:
+      this->connect();
+      break;
+    case CatalogRefreshState::Requesting:
+      this->sendRequest();
+      break;
+    case CatalogRefreshState::ReadingHeaders:
+      this->readHeaders();
+      break;
+    case CatalogRefreshState::ReadingBody:
+      this->readBody();
+      break;
+  }
+}
+
+const char *BrewfatherCatalog::getRefreshStateName() {
+  switch (this->state) {
+    case CatalogRefreshState::Connecting: return "connecting";
+    case CatalogRefreshState::Requesting: return "requesting";
+    case CatalogRefreshState::ReadingHeaders: return "readingHeaders";
+    case CatalogRefreshState::ReadingBody: return "readingBody";
+    default: return "idle";
+  }
+}
+
+void BrewfatherCatalog::setState(CatalogRefreshState newState) {
+  this->state = newState;
+  this->stepStartMillis = millis();
+}
+
+void BrewfatherCatalog::startRefresh() {
+  Logger.printWithFreeHeaps("[BrewfatherCatalog] Update started");
+
+  this->isUpdateRequested = false;
+  this->refreshStartMillis = millis();
+  this->bytesRead = 0;
+  this->parsedEntries.clear();
+  this->parsedEntries.reserve(CATALOG_PAGE_SIZE);
+  this->isEntrySeen.assign(this->entries.size(), false);
+  this->startAfter[0] = 0;
+  this->numPages = 0;
+  this->numEntriesParsed = 0;
+  this->isTruncated = false;
+  this->handshakeMillis = 0;
+  this->transferMillis = 0;
+  this->numHandshakes = 0;
+  this->numRequests = 0;
+  this->responseHash = FNV1A_INITIAL_HASH;
+
+  this->entryBuffer = new char[CATALOG_ENTRY_BUFFER_SIZE];
+  this->updateHeapStats();
+  this->startRequest();
+}
+
+void BrewfatherCatalog::startRequest() {
+  this->lineLength = 0;
+  this->responseStatusCode = 0;
+  this->responseEtag[0] = 0;
+
+  this->isChunked = false;
+  this->bodyRemaining = -1;
+  this->chunkState = ChunkState::Size;
+  this->chunkRemaining = 0;
+  this->isChunkExtension = false;
+  this->trailerLineLength = 0;
+  this->isBodyDone = false;
+
+  this->entryLength = 0;
+  this->depth = 0;
+  this->isInString = false;
+  this->isEscaped = false;
+  this->isArrayStarted = false;
+  this->isArrayDone = false;
+
+  // a connection kept alive by the previous response does not need another handshake
+  bool canReuse = this->isConnectionReusable && this->client->connected();
+  this->setState(canReuse ? CatalogRefreshState::Requesting : CatalogRefreshState::Connecting);
+}
+
+void BrewfatherCatalog::finishResponse() {
+  this->transferMillis += millis() - this->requestStartMillis;
+  if (this->responseStatusCode == HTTP_CODE_NOT_MODIFIED) {
+    this->finishRefresh(true);
+    return;
+  }
+
+  ++this->numPages;
+  bool isLastPage = this->parsedEntries.size() < CATALOG_PAGE_SIZE;
+  this->mergePage();
+
+  // all pages are read even when truncated, as the entries not seen on any of them are removed
+  if (isLastPage) {
+    this->finishRefresh(true);
+  } else {
+    // the next page is requested in the next loop
+    this->startRequest();
+  }
+}
+
+void BrewfatherCatalog::mergePage() {
+  for (CatalogEntry &parsed : this->parsedEntries) {
+    size_t i = 0;
+    while (i < this->entries.size() && strcmp(this->entries[i].id, parsed.id) != 0) {
+      ++i;
+    }
+
+    if (i < this->entries.size()) {
+      this->entries[i] = parsed;
+      this->isEntrySeen[i] = true;
+    } else {
+      if (this->entries.size() >= CATALOG_MAX_ENTRIES) {
+        // removed at the end of the refresh anyway, unless they are on a later page, which adds them again
+        this->removeUnseenEntries();
+      }
+      if (this->entries.size() < CATALOG_MAX_ENTRIES) {
+        this->entries.push_back(parsed);
+        this->isEntrySeen.push_back(true);
+      } else {
+        this->isTruncated = true;
+      }
+    }
+  }
+  this->parsedEntries.clear();
+  this->updateHeapStats();
+}
+
+// Removes the batches which are not conditioning anymore, or not seen in the current refresh so far.
+void BrewfatherCatalog::removeUnseenEntries() {
+  size_t kept = 0;
+  for (size_t i = 0; i < this->entries.size(); ++i) {
+    if (this->isEntrySeen[i]) {
+      this->entries[kept++] = this->entries[i];
+    }
+  }
+  this->entries.resize(kept);
+  this->isEntrySeen.assign(kept, true);
+}
+
+// Accounts the entries with the buffers of the current refresh.
+void BrewfatherCatalog::updateHeapStats() {
+  size_t bytes = (this->entries.capacity() + this->parsedEntries.capacity()) * sizeof(CatalogEntry)
+    + (this->isEntrySeen.capacity() + 7) / 8
+    + this->tlsBufferSize;
+  if (this->entryBuffer != nullptr) {
+    bytes += CATALOG_ENTRY_BUFFER_SIZE;
+  }
+  HeapStats.set(HeapTag::Catalog, bytes);
+}
+
+void BrewfatherCatalog::finishRefresh(bool isSuccess) {
+  // the session is kept for the next refresh, but not the idle connection with its buffers
+  this->client->stop();
+  this->isConnectionReusable = false;
+  this->tlsBufferSize = 0;
+
+  if (isSuccess) {
+    if (this->responseStatusCode == HTTP_CODE_NOT_MODIFIED || this->responseHash == this->contentHash) {
+      Logger.println("[BrewfatherCatalog] Catalog is unchanged.");
+    } else {
+      this->removeUnseenEntries();
+
+      this->contentHash = this->responseHash;
+      // a single response validates the whole catalog only when it had a single page
+      strlcpy(this->etag, this->numPages == 1 ? this->responseEtag : "", sizeof(this->etag));
+    }
+    if (this->isTruncated) {
+      LOG_WARNING("[BrewfatherCatalog] Catalog is limited to %u entries.", (unsigned int) this->entries.size());
+    }
+    this->lastRefresh = Clock.now();
+    this->saveCache();
+    this->nextRefresh = this->lastRefresh + CATALOG_REFRESH_SECONDS;
+    this->lastErrorMessage = String("");
+  } else {
+    this->nextRefresh = Clock.now() + CATALOG_RETRY_SECONDS;
+  }
+  this->parsedEntries.clear();
+  this->parsedEntries.shrink_to_fit();
+  this->isEntrySeen.clear();
+  this->isEntrySeen.shrink_to_fit();
+
+  delete[] this->entryBuffer;
+  this->entryBuffer = nullptr;
+  this->updateHeapStats();
+
+  this->lastHandshakeMillis = this->handshakeMillis;
+  this->lastTransferMillis = this->transferMillis;
+  Metrics.recordCatalogFetch(millis() - this->refreshStartMillis, this->handshakeMillis, isSuccess);
+  this->setState(CatalogRefreshState::Idle);
+
+  LOG_DEBUG(
+    "[BrewfatherCatalog] %u request(s) with %u handshake(s): handshake %u ms, transfer %u ms.",
+    this->numRequests,
+    this->numHandshakes,
+    this->handshakeMillis,
+    this->transferMillis
+  );
+  Logger.printWithFreeHeaps("[BrewfatherCatalog] Update done");
+}
+
+void BrewfatherCatalog::failRefresh(int statusCode, const char *message) {
+  LOG_ERROR("[BrewfatherCatalog] %s", message);
+  this->lastStatusCode = statusCode;
+  this->lastErrorMessage = String(message);
+  this->finishRefresh(false);
+}
+
+void BrewfatherCatalog::connect() {
+  uint32_t start = millis();
+  if (!this->isMFLProbed) {
+    // probed on the first connection only, instead of delaying the boot with it
+    this->useMFL = this->client->probeMaxFragmentLength(BREWFATHER_CATALOG_HOST, 443, 512);
+    this->isMFLProbed = true;
+    LOG_DEBUG("[BrewfatherCatalog] %s MFLN.", this->useMFL ? "Using" : "NOT using");
+  }
+
+  // the TLS handshake cannot be split up, hence this is the longest step
+  size_t rxBufferSize = this->useMFL ? CATALOG_RX_BUFFER_SIZE : 512;
+  this->client->setBufferSizes(rxBufferSize, 512);
+  bool isConnected = this->client->connect(BREWFATHER_CATALOG_HOST, 443);
+  this->handshakeMillis += millis() - start;
+  ++this->numHandshakes;
+
+  if (!isConnected) {
+    this->failRefresh(HTTPC_ERROR_CONNECTION_FAILED, "Unable to connect to the target host.");
+    return;
+  }
+  this->tlsBufferSize = rxBufferSize + 512;
+  this->updateHeapStats();
+  this->setState(CatalogRefreshState::Requesting);
+}
+
+void BrewfatherCatalog::sendRequest() {
+  this->requestStartMillis = millis();
+  ++this->numRequests;
+
+  String credentials = String(this->config->userId) + ":" + this->config->apiKey;
+  // pages continue after the last batch of the previous one
+  this->client->printf("GET %s&limit=%d", BREWFATHER_CATALOG_PATH, CATALOG_PAGE_SIZE);
+  if (this->startAfter[0] != 0) {
+    this->client->printf("&start_after=%s", this->startAfter);
+  }
+  this->client->printf(
+    " HTTP/1.1\r\nHost: %s\r\nAuthorization: Basic %s\r\nAccept: application/json\r\nConnection: keep-alive\r\n",
+    BREWFATHER_CATALOG_HOST,
+    base64::encode(credentials, false).c_str()
+  );
+  if (this->etag[0] != 0 && this->startAfter[0] == 0 && !this->entries.empty()) {
+    this->client->printf("If-None-Match: %s\r\n", this->etag);
+  }
+  this->client->print("\r\n");
+  this->setState(CatalogRefreshState::ReadingHeaders);
+}
+
+// Reads the available bytes of the current line, and tells whether it is complete.
+bool BrewfatherCatalog::readLine() {
+  while (this->client->available() > 0) {
+    int c = this->client->read();
+    if (c < 0) {
+      break;
+    }
+    ++this->bytesRead;
+    if (c == '\n') {
+      if (this->lineLength > 0 && this->lineBuffer[this->lineLength - 1] == '\r') {
+        --this->lineLength;
+      }
+      this->lineBuffer[this->lineLength] = 0;
+      this->lineLength = 0;
+      return true;
+    }
+    if (this->lineLength < CATALOG_LINE_BUFFER_SIZE - 1) {
+      this->lineBuffer[this->lineLength++] = (char) c;
+    }
+  }
+  return false;
+}
+
+void BrewfatherCatalog::readHeaders() {
+  // the headers are small, still do not read more than a line per loop
+  if (!this->readLine()) {
+    if (!this->client->connected()) {
+      this->failRefresh(HTTPC_ERROR_CONNECTION_LOST, "Connection lost while reading the catalog headers.");
+    }
+    return;
+  }
+
+  if (this->responseStatusCode == 0) {
+    if (sscanf(this->lineBuffer, "HTTP/%*s %d", &this->responseStatusCode) != 1) {
+      this->failRefresh(HTTPC_ERROR_NO_HTTP_SERVER, "Invalid catalog response status line.");
+      return;
+    }
+    this->lastStatusCode = this->responseStatusCode;
+    // HTTP/1.1 keeps connections alive by default, unless the headers say otherwise
+    this->isConnectionReusable = strncmp(this->lineBuffer, "HTTP/1.1", 8) == 0;
+  } else if (this->lineBuffer[0] != 0) {
+    this->parseHeader();
+  } else {
+    if (this->responseStatusCode == HTTP_CODE_NOT_MODIFIED) {
+      // there is no body
+      this->finishResponse();
+      return;
+    } else if (this->responseStatusCode != HTTP_CODE_OK) {
+      char message[64];
+      snprintf(message, sizeof(message), "Catalog request failed with status %d.", this->responseStatusCode);
+      this->failRefresh(this->responseStatusCode, message);
+      return;
+    }
+    if (this->bodyRemaining == 0 && !this->isChunked) {
+      this->failRefresh(HTTPC_ERROR_NO_HTTP_SERVER, "Empty catalog response.");
+      return;
+    } else if (this->bodyRemaining < 0 && !this->isChunked) {
+      this->isConnectionReusable = false;
+    }
+    Logger.printWithFreeHeaps("[BrewfatherCatalog] Update in progress");
+    this->setState(CatalogRefreshState::ReadingBody);
+  }
+  this->stepStartMillis = millis();
+}
+
+void BrewfatherCatalog::parseHeader() {
+  char *value = strchr(this->lineBuffer, ':');
+  if (value == nullptr) {
+    return;
+  }
+  *value++ = 0;
+  while (*value == ' ') {
+    ++value;
+  }
+
+  const char *name = this->lineBuffer;
+  if (strcasecmp(name, "ETag") == 0) {
+    strlcpy(this->responseEtag, value, sizeof(this->responseEtag));
+  } else if (strcasecmp(name, "Content-Length") == 0) {
+    this->bodyRemaining = atol(value);
+  } else if (strcasecmp(name, "Transfer-Encoding") == 0) {
+    this->isChunked = strcasestr(value, "chunked") != nullptr;
+  } else if (strcasecmp(name, "Connection") == 0 && strcasecmp(value, "close") == 0) {
+    this->isConnectionReusable = false;
+  }
+}
+
+void BrewfatherCatalog::readBody() {
+  uint8_t chunk[64];
+  size_t budget = CATALOG_MAX_BYTES_PER_LOOP;
+  while (budget > 0 && this->client->available() > 0) {
+    int len = this->client->read(chunk, std::min(std::min(budget, sizeof(chunk)), this->getMaxBodyRead()));
+    if (len <= 0) {
+      break;
+    }
+    this->bytesRead += len;
+    budget -= len;
+    this->stepStartMillis = millis();
+
+    for (int i = 0; i < len && !this->isBodyDone; ++i) {
+      if (!this->consumeBody((char) chunk[i])) {
+        return;
+      }
+    }
+
+    // the rest of a reused connection's body has to be read, otherwise it is done with the array
+    if (this->isBodyDone || (this->isArrayDone && !this->isConnectionReusable)) {
+      if (!this->isArrayDone) {
+        this->failRefresh(HTTPC_ERROR_NO_HTTP_SERVER, "Incomplete catalog response.");
+        return;
+      }
+      this->finishResponse();
+      return;
+    }
+  }
+
+  if (budget == CATALOG_MAX_BYTES_PER_LOOP && !this->client->connected()) {
+    this->failRefresh(HTTPC_ERROR_CONNECTION_LOST, "Connection lost while reading the catalog.");
+  }
+}
+
+// Limits reads to the current body, as a reused connection is followed by the next response.
+size_t BrewfatherCatalog::getMaxBodyRead() {
+  if (!this->isChunked) {
+    return this->bodyRemaining > 0 ? this->bodyRemaining : SIZE_MAX;
+  }
+  // the framing between chunks is read byte by byte
+  return this->chunkState == ChunkState::Data ? this->chunkRemaining : 1;
+}
+
+// Removes the transfer encoding of the body, and passes on its payload.
+bool BrewfatherCatalog::consumeBody(char c) {
+  if (!this->isChunked) {
+    if (this->bodyRemaining > 0 && --this->bodyRemaining == 0) {
+      this->isBodyDone = true;
+    }
+    return this->consumePayload(c);
+  }
+
+  switch (this->chunkState) {
+    case ChunkState::Size:
+      if (c == '\n') {
+        this->chunkState = this->chunkRemaining > 0 ? ChunkState::Data : ChunkState::Trailer;
+      } else if (c == ';') {
+        this->isChunkExtension = true;
+      } else if (isxdigit(c) && !this->isChunkExtension) {
+        this->chunkRemaining = this->chunkRemaining * 16 + (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+      }
+      return true;
+    case ChunkState::Data:
+      if (--this->chunkRemaining == 0) {
+        this->chunkState = ChunkState::DataEnd;
+      }
+      return this->consumePayload(c);
+    case ChunkState::DataEnd:
+      if (c == '\n') {
+        this->chunkState = ChunkState::Size;
+        this->isChunkExtension = false;
+      }
+      return true;
+    case ChunkState::Trailer:
+      if (c == '\n') {
+        this->isBodyDone = this->trailerLineLength == 0;
+        this->trailerLineLength = 0;
+      } else if (c != '\r') {
+        ++this->trailerLineLength;
+      }
+      return true;
+  }
+  return true;
+}
+
+bool BrewfatherCatalog::consumePayload(char c) {
+  this->responseHash = fnv1aHash(&c, 1, this->responseHash);
+  return this->isArrayDone || this->consume(c);
+}
+
+// Collects the characters of the current batch, tracking nesting and strings,
+// until the batch is complete. Fails the refresh and returns false on errors.
+bool BrewfatherCatalog::consume(char c) {
+  if (!this->isArrayStarted) {
+    if (c == '[') {
+      this->isArrayStarted = true;
+    } else if (!isspace(c)) {
+      this->failRefresh(HTTPC_ERROR_NO_HTTP_SERVER, "Invalid catalog response.");
+      return false;
+    }
+    return true;
+  }
+
+  if (this->depth == 0) {
+    if (c == ']') {
+      this->isArrayDone = true;
+    } else if (c == '{') {
+      this->entryBuffer[0] = c;
+      this->entryLength = 1;
+      this->depth = 1;
+    } else if (c != ',' && !isspace(c)) {
+      this->failRefresh(HTTPC_ERROR_NO_HTTP_SERVER, "Invalid catalog response.");
+      return false;
+    }
+    return true;
+  }
+
+  if (this->entryLength >= CATALOG_ENTRY_BUFFER_SIZE) {
+    this->failRefresh(HTTPC_ERROR_TOO_LESS_RAM, "Catalog entry is too large.");
+    return false;
+  }
+  this->entryBuffer[this->entryLength++] = c;
+
+  if (this->isInString) {
+    if (this->isEscaped) {
+      this->isEscaped = false;
+    } else if (c == '\\') {
+      this->isEscaped = true;
+    } else if (c == '"') {
+      this->isInString = false;
+    }
+  } else if (c == '"') {
+    this->isInString = true;
+  } else if (c == '{' || c == '[') {
+    ++this->depth;
+  } else if (c == '}' || c == ']') {
+    --this->depth;
+    if (this->depth == 0) {
+      return this->parseEntry();
+    }
+  }
+  return true;
+}
+
+bool BrewfatherCatalog::parseEntry() {
+  StaticJsonDocument<CATALOG_ENTRY_JSON_SIZE> doc;
+  DeserializationError error = deserializeJson(doc, this->entryBuffer, this->entryLength, DeserializationOption::Filter(this->filter));
+  if (error) {
+    this->failRefresh(HTTPC_ERROR_NO_HTTP_SERVER, error.c_str());
+    return false;
+  }
+
+  JsonObject entryToParse = doc.as<JsonObject>();
+  CatalogEntry currentEntry;
+  strlcpy(currentEntry.id, entryToParse["_id"] | "", sizeof(currentEntry.id));
+  currentEntry.number = entryToParse["batchNo"];
+  strlcpy(currentEntry.name, entryToParse["recipe"]["name"] | "", sizeof(currentEntry.name));
+  currentEntry.bottlingDate = (int)(entryToParse["bottlingDate"].as<double>() / 1000l);
+  currentEntry.bottlingVolume = entryToParse["measuredBottlingSize"];
+  currentEntry.finalGravity = entryToParse["measuredFg"].as<float>() * 1000.0;
+  currentEntry.abv = entryToParse["measuredAbv"];
+  currentEntry.srm = entryToParse["recipe"]["color"];
+  this->parsedEntries.push_back(currentEntry);
+  strlcpy(this->startAfter, currentEntry.id, sizeof(this->startAfter));
+  ++this->numEntriesParsed;
+  return true;
+}
+
+void BrewfatherCatalog::loadCache() {
+  File file = LittleFS.open(CATALOG_CACHE_PATH, "r");
+  if (!file) {
+    return;
+  }
+
+  CatalogCacheHeader header;
+  bool isValid = file.read((uint8_t *) &header, sizeof(header)) == sizeof(header)
+    && header.magic == CATALOG_CACHE_MAGIC
+    && header.version == CATALOG_CACHE_VERSION
+    && header.entrySize == sizeof(CatalogEntry)
+    && file.size() == sizeof(header) + header.numEntries * sizeof(CatalogEntry);
+
+  if (isValid) {
+    HeapSelectIram ephemeral;
+    this->entries.resize(header.numEntries);
+    size_t len = header.numEntries * sizeof(CatalogEntry);
+    isValid = len == 0 || file.read((uint8_t *) this->entries.data(), len) == len;
+  }
+  file.close();
+
+  if (!isValid) {
+    LOG_WARNING("[BrewfatherCatalog] Ignoring invalid catalog cache.");
+    this->entries.clear();
+    return;
+  }
+
+  this->contentHash = header.contentHash;
+  header.etag[sizeof(header.etag) - 1] = 0;
+  strlcpy(this->etag, header.etag, sizeof(this->etag));
+  this->lastRefresh = header.lastRefresh;
+  this->nextRefresh = header.lastRefresh + CATALOG_REFRESH_SECONDS;
+  this->updateHeapStats();
+  Logger.printf("[BrewfatherCatalog] Loaded %u cached entries.\n", header.numEntries);
+}
+
+void BrewfatherCatalog::saveCache() {
+  CatalogCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = CATALOG_CACHE_MAGIC;
+  header.version = CATALOG_CACHE_VERSION;
+  header.entrySize = sizeof(CatalogEntry);
+  header.numEntries = this->entries.size();
+  header.contentHash = this->contentHash;
+  header.lastRefresh = this->lastRefresh;
+  strlcpy(header.etag, this->etag, sizeof(header.etag));
+
+  // written aside first, so that a reset while writing keeps the previous cache
+  File file = LittleFS.open(CATALOG_CACHE_TEMP_PATH, "w");
+  if (!file) {
+    LOG_ERROR("[BrewfatherCatalog] Unable to write catalog cache.");
+    return;
+  }
+  size_t len = header.numEntries * sizeof(CatalogEntry);
+  bool isWritten = file.write((const uint8_t *) &header, sizeof(header)) == sizeof(header)
+    && (len == 0 || file.write((const uint8_t *) this->entries.data(), len) == len);
+  file.close();
+
+  if (!isWritten || !LittleFS.rename(CATALOG_CACHE_TEMP_PATH, CATALOG_CACHE_PATH)) {
+    LOG_ERROR("[BrewfatherCatalog] Unable to write catalog cache.");
+    LittleFS.remove(CATALOG_CACHE_TEMP_PATH);
+  }
+}
@@ -0,0 +1,91 @@
+#include <coredecls.h>
+#include <ESPDateTime.h>
+#include <sys/time.h>
+#include <user_interface.h>
+
+#include "clock.h"
+#include "logger.h"
+
+ClockClass Clock;
+
+void ClockClass::begin() {
+  DateTime.setTimeZone("UTC0");
+
+  ClockRtcData data;
+  ESP.rtcUserMemoryRead(RTC_MEMORY_CLOCK_OFFSET, (uint32_t *) &data, sizeof(data));
+  if (data.magic != CLOCK_RTC_MAGIC) {
+    return;
+  }
+  // the RTC counter starts again from zero after a power loss, an external reset and a deep sleep,
+  // whereas the RTC memory survives the latter two
+  uint32_t reason = ESP.getResetInfoPtr()->reason;
+  if (reason == REASON_DEFAULT_RST || reason == REASON_EXT_SYS_RST || reason == REASON_DEEP_SLEEP_AWAKE) {
+    return;
+  }
+
+  uint32_t rtcTime = system_get_rtc_time();
+  if (rtcTime < data.rtcTime) {
+    LOG_WARNING("[Clock] RTC counter restarted, the time is not restored.");
+    return;
+  }
+  uint64_t elapsedMicros = ((uint64_t) (rtcTime - data.rtcTime) * data.rtcCalibration) >> 12;
+  if (elapsedMicros > (uint64_t) CLOCK_MAX_RESTORE_GAP_SECONDS * 1000000) {
+    LOG_WARNING("[Clock] Implausible time since the last save, the time is not restored.");
+    return;
+  }
+  this->setWallTimeMillis((int64_t) data.epochSeconds * 1000 + (int64_t) (elapsedMicros / 1000));
+  this->isRestored = true;
+  Logger.printf("[Clock] Restored time from RTC memory: %s.\n", DateTime.toString().c_str());
+}
+
+void ClockClass::startSync() {
+  settimeofday_cb([this](bool isFromSntp) {
+    // called from the SNTP client, so only flagged here
+    if (isFromSntp) {
+      this->isSyncPending = true;
+    }
+  });
+  configTime(0, 0, CLOCK_NTP_SERVER);
+}
+
+void ClockClass::setWallTimeMillis(int64_t wallTimeMillis) {
+  this->epochOffsetMillis = wallTimeMillis - (int64_t) this->monotonicMillis();
+  // the formatted times on the status page still come from DateTime
+  DateTime.setTime((time_t) (wallTimeMillis / 1000));
+}
+
+void ClockClass::save() {
+  ClockRtcData data;
+  data.magic = CLOCK_RTC_MAGIC;
+  data.rtcTime = system_get_rtc_time();
+  data.rtcCalibration = system_rtc_clock_cali_proc();
+  data.epochSeconds = (uint32_t) ((this->epochOffsetMillis + (int64_t) this->monotonicMillis()) / 1000);
+  ESP.rtcUserMemoryWrite(RTC_MEMORY_CLOCK_OFFSET, (uint32_t *) &data, sizeof(data));
+  this->lastSaveMillis = millis();
+}
+
+void ClockClass::handle() {
+  // keeps track of the wraps of millis(), even when nothing asks for the time
+  this->monotonicMillis();
+
+  if (this->isSyncPending) {
+    this->isSyncPending = false;
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    int64_t wallTimeMillis = (int64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    int64_t correctionMillis = wallTimeMillis - (this->epochOffsetMillis + (int64_t) this->monotonicMillis());
+    this->setWallTimeMillis(wallTimeMillis);
+    if (!this->isSynced) {
+      Logger.printf("[Clock] Time synchronized: %s.\n", DateTime.toString().c_str());
+    } else {
+      LOG_DEBUG("[Clock] Time resynchronized, corrected by %d ms.", (int) correctionMillis);
+    }
+    this->isSynced = true;
+    this->save();
+  }
+
+  // the calibration of the RTC changes with the temperature, so it is refreshed from time to time
+  if (this->isValid() && millis() - this->lastSaveMillis >= CLOCK_RTC_SAVE_INTERVAL_MILLIS) {
+    this->save();
+  }
+}
@@ -0,0 +1,308 @@
+#include "config.h"
+#include "hash.h"
+#include "logger.h"
+
+static uint32_t hashFile(File &file) {
+  uint8_t buffer[CONFIG_HASH_BUFFER_SIZE];
+  uint32_t hash = FNV1A_INITIAL_HASH;
+  size_t len;
+  while ((len = file.read(buffer, sizeof(buffer))) > 0) {
+    hash = fnv1aHash(buffer, len, hash);
+  }
+  return hash;
+}
+
+static void skipWhitespace(File &file) {
+  while (isspace(file.peek())) {
+    file.read();
+  }
+}
+
+// reads the rest of a string after its opening quote, keeping as much of it as fits
+static bool readString(File &file, char *buffer, size_t size) {
+  size_t len = 0;
+  int c;
+  while ((c = file.read()) >= 0) {
+    if (c == '"') {
+      if (size > 0) {
+        buffer[len < size ? len : size - 1] = 0;
+      }
+      return true;
+    }
+    if (c == '\\') {
+      c = file.read();
+    }
+    if (len < size) {
+      buffer[len] = (char) c;
+    }
+    ++len;
+  }
+  return false;
+}
+
+// skips a value of any type, up to the separator following it
+static bool skipValue(File &file) {
+  int depth = 0;
+  while (file.available()) {
+    int c = file.peek();
+    if (depth == 0 && (c == ',' || c == '}' || c == ']')) {
+      return true;
+    }
+    file.read();
+    if (c == '"') {
+      if (!readString(file, nullptr, 0)) {
+        return false;
+      }
+    } else if (c == '{' || c == '[') {
+      ++depth;
+    } else if (c == '}' || c == ']') {
+      --depth;
+    }
+  }
+  return false;
+}
+
+// Positions the file on the first element of a top level array, which is then read one
+// element at a time with findUntil(",", "]"). Returns false when the array is missing or empty.
+// The members of the top level object are walked in order, so that neither string values
+// nor nested objects with the same key are mistaken for the array.
+static bool findArray(File &file, const char *key) {
+  file.seek(0);
+  skipWhitespace(file);
+  if (file.read() != '{') {
+    return false;
+  }
+
+  while (true) {
+    skipWhitespace(file);
+    char name[16];
+    if (file.read() != '"' || !readString(file, name, sizeof(name))) {
+      return false;
+    }
+    skipWhitespace(file);
+    if (file.read() != ':') {
+      return false;
+    }
+    skipWhitespace(file);
+
+    if (strcmp(name, key) == 0) {
+      if (file.read() != '[') {
+        return false;
+      }
+      skipWhitespace(file);
+      return file.peek() != ']';
+    }
+
+    if (!skipValue(file)) {
+      return false;
+    }
+    skipWhitespace(file);
+    if (file.read() != ',') {
+      return false;
+    }
+  }
+}
+
+bool Config::load() {
+  File configFile = LittleFS.open(CONFIG_PATH, "r");
+  if (!configFile) {
+    return false;
+  }
+
+  uint32_t sourceHash = hashFile(configFile);
+  uint32_t sourceSize = configFile.size();
+  bool isLoaded = this->loadCache(sourceHash, sourceSize);
+  if (!isLoaded) {
+    Logger.println("[Config] Configuration changed, parsing it.");
+    configFile.seek(0);
+    isLoaded = this->parse(configFile);
+    if (isLoaded) {
+      this->saveCache(sourceHash, sourceSize);
+    }
+  }
+  configFile.close();
+  if (!isLoaded) {
+    return false;
+  }
+
+  File stampFile = LittleFS.open("/stamp", "r");
+  if (!stampFile) {
+    return false;
+  }
+  strlcpy(this->fsLastModified, stampFile.readString().c_str(), sizeof(this->fsLastModified));
+  stampFile.close();
+
+  return true;
+}
+
+bool Config::parse(File &file) {
+  // files do not receive more data, so waiting at their end for it is pointless
+  file.setTimeout(0);
+
+  // the arrays are skipped here, so that the document size does not depend on them
+  StaticJsonDocument<CONFIG_FILTER_JSON_SIZE> filter;
+  filter["hostname"] = true;
+  filter["httpPort"] = true;
+  filter["catalog"] = true;
+  filter["ota"] = true;
+
+  StaticJsonDocument<CONFIG_ELEMENT_JSON_SIZE> doc;
+  DeserializationError error = deserializeJson(doc, file, DeserializationOption::Filter(filter));
+  if (error) {
+    return false;
+  }
+
+  strlcpy(this->hostname, doc["hostname"] | "keg-scale", sizeof(this->hostname));
+  this->httpPort = doc["httpPort"] | 80;
+
+  strlcpy(this->catalog.brewfather.userId, doc["catalog"]["brewfather"]["userId"] | "", sizeof(this->catalog.brewfather.userId));
+  strlcpy(this->catalog.brewfather.apiKey, doc["catalog"]["brewfather"]["apiKey"] | "", sizeof(this->catalog.brewfather.apiKey));
+
+  this->ota.port = doc["ota"]["port"] | 8266;
+  strlcpy(this->ota.password, doc["ota"]["password"] | "", sizeof(this->ota.password));
+
+  this->wifis.clear();
+  if (findArray(file, "wifis")) {
+    do {
+      if (deserializeJson(doc, file)) {
+        return false;
+      }
+      WiFiConfig currentWifi;
+      strlcpy(currentWifi.ssid, doc["ssid"] | "", sizeof(currentWifi.ssid));
+      strlcpy(currentWifi.passphrase, doc["passphrase"] | "", sizeof(currentWifi.passphrase));
+      this->wifis.push_back(currentWifi);
+    } while (file.findUntil(",", "]"));
+  }
+
+  this->scales.clear();
+  if (findArray(file, "scales")) {
+    do {
+      if (deserializeJson(doc, file)) {
+        return false;
+      }
+      ScaleConfig currentScale;
+      const char *label = doc["label"];
+      if (label != nullptr) {
+        strlcpy(currentScale.label, label, sizeof(currentScale.label));
+      } else {
+        snprintf(currentScale.label, sizeof(currentScale.label), "Scale %u", (unsigned int) this->scales.size());
+      }
+      currentScale.clockPin = doc["clockPin"];
+      currentScale.dataPin = doc["dataPin"];
+      currentScale.gain = doc["gain"] | 128;
+      currentScale.reverse = doc["reverse"] | false;
+      currentScale.initMillis = doc["initMillis"] | 5000;
+      currentScale.initTare = doc["initTare"] | false;
+      this->scales.push_back(currentScale);
+    } while (file.findUntil(",", "]"));
+  }
+
+  this->weights.clear();
+  if (findArray(file, "weights")) {
+    do {
+      if (deserializeJson(doc, file)) {
+        return false;
+      }
+      Weight currentWeight;
+      strlcpy(currentWeight.label, doc["label"] | "", sizeof(currentWeight.label));
+      currentWeight.mass = doc["mass"];
+      currentWeight.forTare = doc["forTare"] | false;
+      currentWeight.forCalibration = doc["forCalibration"] | false;
+      this->weights.push_back(currentWeight);
+    } while (file.findUntil(",", "]"));
+  }
+
+  return true;
+}
+
+bool Config::loadCache(uint32_t sourceHash, uint32_t sourceSize) {
+  File file = LittleFS.open(CONFIG_CACHE_PATH, "r");
+  if (!file) {
+    return false;
+  }
+
+  // the whole image with a single read
+  size_t size = file.size();
+  uint8_t *image = nullptr;
+  bool isValid = size >= sizeof(ConfigCacheHeader) && size <= CONFIG_CACHE_MAX_SIZE;
+  if (isValid) {
+    image = new uint8_t[size];
+    isValid = file.read(image, size) == size;
+  }
+  file.close();
+
+  ConfigCacheHeader header;
+  if (isValid) {
+    memcpy(&header, image, sizeof(header));
+    isValid = header.magic == CONFIG_CACHE_MAGIC
+      && header.version == CONFIG_CACHE_VERSION
+      && header.sourceHash == sourceHash
+      && header.sourceSize == sourceSize
+      && header.wifiSize == sizeof(WiFiConfig)
+      && header.scaleSize == sizeof(ScaleConfig)
+      && header.weightSize == sizeof(Weight)
+      && size == sizeof(header)
+        + header.numWifis * sizeof(WiFiConfig)
+        + header.numScales * sizeof(ScaleConfig)
+        + header.numWeights * sizeof(Weight);
+  }
+
+  if (isValid) {
+    memcpy(this->hostname, header.hostname, sizeof(this->hostname));
+    this->httpPort = header.httpPort;
+    this->catalog = header.catalog;
+    this->ota = header.ota;
+
+    const uint8_t *current = image + sizeof(header);
+    this->wifis.resize(header.numWifis);
+    memcpy(this->wifis.data(), current, header.numWifis * sizeof(WiFiConfig));
+    current += header.numWifis * sizeof(WiFiConfig);
+    this->scales.resize(header.numScales);
+    memcpy(this->scales.data(), current, header.numScales * sizeof(ScaleConfig));
+    current += header.numScales * sizeof(ScaleConfig);
+    this->weights.resize(header.numWeights);
+    memcpy(this->weights.data(), current, header.numWeights * sizeof(Weight));
+  }
+
+  delete[] image;
+  return isValid;
+}
+
+void Config::saveCache(uint32_t sourceHash, uint32_t sourceSize) {
+  ConfigCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = CONFIG_CACHE_MAGIC;
+  header.version = CONFIG_CACHE_VERSION;
+  header.numWifis = this->wifis.size();
+  header.numScales = this->scales.size();
+  header.numWeights = this->weights.size();
+  header.sourceHash = sourceHash;
+  header.sourceSize = sourceSize;
+  header.wifiSize = sizeof(WiFiConfig);
+  header.scaleSize = sizeof(ScaleConfig);
+  header.weightSize = sizeof(Weight);
+  memcpy(header.hostname, this->hostname, sizeof(header.hostname));
+  header.httpPort = this->httpPort;
+  header.catalog = this->catalog;
+  header.ota = this->ota;
+
+  // written aside first, so that a reset while writing keeps the previous image
+  File file = LittleFS.open(CONFIG_CACHE_TEMP_PATH, "w");
+  if (!file) {
+    LOG_ERROR("[Config] Unable to write configuration cache.");
+    return;
+  }
+  size_t wifisLen = header.numWifis * sizeof(WiFiConfig);
+  size_t scalesLen = header.numScales * sizeof(ScaleConfig);
+  size_t weightsLen = header.numWeights * sizeof(Weight);
+  bool isWritten = file.write((const uint8_t *) &header, sizeof(header)) == sizeof(header)
+    && (wifisLen == 0 || file.write((const uint8_t *) this->wifis.data(), wifisLen) == wifisLen)
+    && (scalesLen == 0 || file.write((const uint8_t *) this->scales.data(), scalesLen) == scalesLen)
+    && (weightsLen == 0 || file.write((const uint8_t *) this->weights.data(), weightsLen) == weightsLen);
+  file.close();
+
+  if (!isWritten || !LittleFS.rename(CONFIG_CACHE_TEMP_PATH, CONFIG_CACHE_PATH)) {
+    LOG_ERROR("[Config] Unable to write configuration cache.");
+    LittleFS.remove(CONFIG_CACHE_TEMP_PATH);
+  }
+}
@@ -0,0 +1,123 @@
+#include "crash_trace.h"
+
+CrashTraceClass CrashTrace;
+
+static const char *PHASE_NAMES[] = {"setup", "network", "ota", "catalog", "scales", "logger", "system"};
+static const char LEVEL_PREFIXES[] = {'E', 'W', 'I', 'D'};
+
+void CrashTraceClass::begin() {
+  CrashTraceData *trace = new CrashTraceData;
+  ESP.rtcUserMemoryRead(CRASH_TRACE_RTC_OFFSET, (uint32_t *) trace, sizeof(CrashTraceData));
+  // the RTC memory is random after a power loss
+  if (trace->magic == CRASH_TRACE_MAGIC && ESP.getResetInfoPtr()->reason != REASON_DEFAULT_RST) {
+    this->lastTrace = trace;
+  } else {
+    delete trace;
+  }
+
+  CrashTraceData empty;
+  memset(&empty, 0, sizeof(empty));
+  empty.magic = CRASH_TRACE_MAGIC;
+  empty.phaseMillis = millis();
+  empty.phase = TracedPhase::Setup;
+  this->write(0, &empty, sizeof(empty));
+  this->numEvents = 0;
+  this->isStarted = true;
+}
+
+void CrashTraceClass::recordLog(uint8_t level, const char *text, size_t len) {
+  if (!this->isStarted) {
+    return;
+  }
+
+  CrashTraceEvent event;
+  event.millis = millis();
+  event.level = level;
+  if (len > CRASH_TRACE_EVENT_TEXT_SIZE - 1) {
+    len = CRASH_TRACE_EVENT_TEXT_SIZE - 1;
+  }
+  memcpy(event.text, text, len);
+  memset(event.text + len, 0, CRASH_TRACE_EVENT_TEXT_SIZE - len);
+
+  size_t slot = this->numEvents % CRASH_TRACE_NUM_EVENTS;
+  this->write(offsetof(CrashTraceData, events) + slot * sizeof(CrashTraceEvent), &event, sizeof(event));
+  ++this->numEvents;
+  this->write(offsetof(CrashTraceData, numEvents), &this->numEvents, sizeof(this->numEvents));
+}
+
+void CrashTraceClass::recordScaleState(int index, const char *stateName) {
+  if (!this->isStarted || index < 0 || index >= CRASH_TRACE_MAX_SCALES) {
+    return;
+  }
+
+  uint32_t words[CRASH_TRACE_STATE_NAME_SIZE / 4] = {0};
+  strncpy((char *) words, stateName, CRASH_TRACE_STATE_NAME_SIZE - 1);
+  this->write(offsetof(CrashTraceData, scales) + index * sizeof(CrashTraceScale), words, sizeof(words));
+}
+
+void CrashTraceClass::recordRecorderCursor(int index, uint32_t recordingId, uint32_t recordingValue) {
+  if (!this->isStarted || index < 0 || index >= CRASH_TRACE_MAX_SCALES) {
+    return;
+  }
+
+  uint32_t words[2] = {recordingId, recordingValue};
+  this->write(offsetof(CrashTraceData, scales) + index * sizeof(CrashTraceScale) + offsetof(CrashTraceScale, recordingId), words, sizeof(words));
+}
+
+void CrashTraceClass::render(JsonDocument &doc) const {
+  rst_info *resetInfo = ESP.getResetInfoPtr();
+  doc["resetReason"] = ESP.getResetReason();
+  JsonObject info = doc.createNestedObject("resetInfo");
+  info["reason"] = resetInfo->reason;
+  info["exccause"] = resetInfo->exccause;
+  info["epc1"] = resetInfo->epc1;
+  info["epc2"] = resetInfo->epc2;
+  info["epc3"] = resetInfo->epc3;
+  info["excvaddr"] = resetInfo->excvaddr;
+  info["depc"] = resetInfo->depc;
+
+  if (this->lastTrace == nullptr) {
+    doc["trace"] = nullptr;
+    return;
+  }
+
+  const CrashTraceData *trace = this->lastTrace;
+  JsonObject traceObj = doc.createNestedObject("trace");
+  traceObj["phaseMillis"] = trace->phaseMillis;
+  traceObj["phase"] = (uint32_t) trace->phase < (uint32_t) TracedPhase::Count
+    ? PHASE_NAMES[(uint32_t) trace->phase]
+    : "unknown";
+
+  JsonArray scales = traceObj.createNestedArray("scales");
+  for (size_t i = 0; i < CRASH_TRACE_MAX_SCALES; ++i) {
+    const CrashTraceScale &scale = trace->scales[i];
+    if (scale.stateName[0] == 0) {
+      continue;
+    }
+    JsonObject scaleObj = scales.createNestedObject();
+    scaleObj["index"] = i;
+    // copied, as the name may be unterminated when the reset interrupted its write
+    char stateName[CRASH_TRACE_STATE_NAME_SIZE + 1];
+    strlcpy(stateName, scale.stateName, sizeof(stateName));
+    scaleObj["state"] = stateName;
+    if (scale.recordingId != 0) {
+      scaleObj["recordingId"] = scale.recordingId;
+      scaleObj["recordingValue"] = scale.recordingValue;
+    }
+  }
+
+  // the oldest event first
+  JsonArray log = traceObj.createNestedArray("log");
+  uint32_t numEvents = trace->numEvents;
+  uint32_t first = numEvents > CRASH_TRACE_NUM_EVENTS ? numEvents - CRASH_TRACE_NUM_EVENTS : 0;
+  for (uint32_t i = first; i < numEvents; ++i) {
+    const CrashTraceEvent &event = trace->events[i % CRASH_TRACE_NUM_EVENTS];
+    char line[CRASH_TRACE_EVENT_TEXT_SIZE + 3];
+    snprintf(line, sizeof(line), "%c %.*s",
+      event.level < sizeof(LEVEL_PREFIXES) ? LEVEL_PREFIXES[event.level] : '?',
+      CRASH_TRACE_EVENT_TEXT_SIZE, event.text);
+    JsonObject eventObj = log.createNestedObject();
+    eventObj["millis"] = event.millis;
+    eventObj["line"] = line;
+  }
+}
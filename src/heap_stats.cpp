@@ -0,0 +1,101 @@
+#include <umm_malloc/umm_heap_select.h>
+
+#include "heap_stats.h"
+
+HeapStatsClass HeapStats;
+
+static const char *heapTagNames[] = {
+  "recorder",
+  "webSocket",
+  "catalog",
+  "json",
+  "webRequests"
+};
+
+static_assert(sizeof(heapTagNames) / sizeof(heapTagNames[0]) == (size_t) HeapTag::Count, "Each heap tag needs a name.");
+
+static size_t bufferBytes(AsyncWebSocketMessageBuffer *buffer) {
+  // the data has room for a terminating zero
+  return sizeof(AsyncWebSocketMessageBuffer) + buffer->length() + 1;
+}
+
+void HeapStatsClass::sampleFreeHeaps() {
+  {
+    HeapSelectDram ephemeral;
+    uint32_t freeHeap = ESP.getFreeHeap();
+    if (freeHeap < this->minFreeDramHeap) {
+      this->minFreeDramHeap = freeHeap;
+    }
+  }
+  {
+    HeapSelectIram ephemeral;
+    uint32_t freeHeap = ESP.getFreeHeap();
+    if (freeHeap < this->minFreeIramHeap) {
+      this->minFreeIramHeap = freeHeap;
+    }
+  }
+}
+
+// the library keeps a buffer without data as well, which is freed on its next cleanup as it has no references
+static bool hasData(AsyncWebSocketMessageBuffer *buffer) {
+  return buffer != nullptr && buffer->get() != nullptr;
+}
+
+AsyncWebSocketMessageBuffer *HeapStatsClass::makeBuffer(AsyncWebSocket &socket, size_t len, bool isLongLived) {
+  AsyncWebSocketMessageBuffer *buffer = nullptr;
+  if (!isLongLived) {
+    HeapSelectIram ephemeral;
+    buffer = socket.makeBuffer(len);
+  }
+  if (!hasData(buffer)) {
+    HeapSelectDram ephemeral;
+    buffer = socket.makeBuffer(len);
+  }
+  if (!hasData(buffer)) {
+    this->sampleFreeHeaps();
+    return nullptr;
+  }
+
+  if (this->numBuffers < HEAP_STATS_MAX_TRACKED_BUFFERS) {
+    // the library does not delete buffers which are still referenced
+    (*buffer)++;
+    this->buffers[this->numBuffers++] = buffer;
+    this->add(HeapTag::WebSocket, bufferBytes(buffer));
+  } else {
+    ++this->numUntrackedBuffers;
+  }
+  this->sampleFreeHeaps();
+  return buffer;
+}
+
+void HeapStatsClass::handle() {
+  // buffers are only made and queued within a single callback or loop step, so none is pending here
+  size_t i = 0;
+  while (i < this->numBuffers) {
+    AsyncWebSocketMessageBuffer *buffer = this->buffers[i];
+    (*buffer)--;
+    if (buffer->canDelete()) {
+      this->remove(HeapTag::WebSocket, bufferBytes(buffer));
+      this->buffers[i] = this->buffers[--this->numBuffers];
+    } else {
+      (*buffer)++;
+      ++i;
+    }
+  }
+
+  this->sampleFreeHeaps();
+}
+
+void HeapStatsClass::render(JsonObject obj) const {
+  for (size_t i = 0; i < (size_t) HeapTag::Count; ++i) {
+    JsonObject tag = obj.createNestedObject(heapTagNames[i]);
+    tag["currentBytes"] = this->currentBytes[i];
+    tag["peakBytes"] = this->peakBytes[i];
+  }
+}
+
+void HeapStatsClass::renderFreeHeaps(JsonObject heap) const {
+  heap["minFreeDramHeap"] = this->minFreeDramHeap;
+  heap["minFreeIramHeap"] = this->minFreeIramHeap;
+  heap["untrackedMessageBuffers"] = this->numUntrackedBuffers;
+}
@@ -1,3 +1,151 @@
 #include "logger.h"
+#include "crash_trace.h"
+#include "heap_stats.h"
 
 LoggerClass Logger;
+
+static const char LEVEL_PREFIXES[] = {'E', 'W', 'I', 'D'};
+
+LoggerClass::LoggerClass()
+  : logSocket("/log")
+  , level(LOG_DEFAULT_LEVEL)
+  , lineLength(0)
+  , lineLevel(LOG_LEVEL_INFO)
+  , lineStartMillis(0)
+  , head(0)
+  , tail(0)
+  , flushed(0)
+  , lastFlushMillis(0)
+  , droppedLines(0) {
+  this->logSocket.onEvent([this](AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+    if (type == WS_EVT_CONNECT) {
+      // the backlog up to the last flush, everything after it follows with the next one
+      if (this->flushed != this->tail) {
+        AsyncWebSocketMessageBuffer *message = this->makeMessage(this->tail, this->flushed);
+        if (message != nullptr) {
+          client->text(message);
+        }
+      }
+    }
+  });
+}
+
+size_t LoggerClass::write(uint8_t b) {
+  if (this->lineLength == 0) {
+    this->lineStartMillis = millis();
+  }
+  if (b == '\n') {
+    this->commitLine();
+  } else if (this->lineLength < LOG_LINE_SIZE - 1) {
+    this->line[this->lineLength++] = (char) b;
+  }
+  return 1;
+}
+
+size_t LoggerClass::write(const uint8_t *buffer, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    this->write(buffer[i]);
+  }
+  return len;
+}
+
+void LoggerClass::log(uint8_t messageLevel, const char *format, ...) {
+  if (messageLevel > this->level) {
+    return;
+  }
+
+  char message[LOG_LINE_SIZE];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  if (len < 0) {
+    return;
+  }
+
+  // a partial line printed before belongs to another message
+  if (this->lineLength > 0) {
+    this->commitLine();
+  }
+  this->lineLevel = messageLevel;
+  this->print(message);
+  if (this->lineLength > 0) {
+    this->commitLine();
+  }
+}
+
+void LoggerClass::commitLine() {
+  uint8_t currentLevel = this->lineLevel;
+  this->lineLevel = LOG_LEVEL_INFO;
+  size_t len = this->lineLength;
+  this->lineLength = 0;
+  if (currentLevel > this->level) {
+    return;
+  }
+  CrashTrace.recordLog(currentLevel, this->line, len);
+
+  // "<level> <line>\n"
+  size_t needed = len + 3;
+  while (LOG_BUFFER_SIZE - (this->head - this->tail) < needed) {
+    // drop the oldest line
+    while (this->buffer[this->tail++ % LOG_BUFFER_SIZE] != '\n');
+    if ((int32_t) (this->flushed - this->tail) < 0) {
+      this->flushed = this->tail;
+      ++this->droppedLines;
+    }
+  }
+
+  this->buffer[this->head++ % LOG_BUFFER_SIZE] = LEVEL_PREFIXES[currentLevel];
+  this->buffer[this->head++ % LOG_BUFFER_SIZE] = ' ';
+  for (size_t i = 0; i < len; ++i) {
+    this->buffer[this->head++ % LOG_BUFFER_SIZE] = this->line[i];
+  }
+  this->buffer[this->head++ % LOG_BUFFER_SIZE] = '\n';
+}
+
+AsyncWebSocketMessageBuffer *LoggerClass::makeMessage(uint32_t from, uint32_t to) {
+  size_t len = to - from;
+  AsyncWebSocketMessageBuffer *message = HeapStats.makeBuffer(this->logSocket, len);
+  if (message == nullptr) {
+    return nullptr;
+  }
+  char *data = (char *) message->get();
+  for (size_t i = 0; i < len; ++i) {
+    data[i] = this->buffer[(from + i) % LOG_BUFFER_SIZE];
+  }
+  return message;
+}
+
+void LoggerClass::flush() {
+  if (this->flushed == this->head) {
+    return;
+  }
+
+  if (this->logSocket.count() > 0) {
+    AsyncWebSocketMessageBuffer *message = this->makeMessage(this->flushed, this->head);
+    if (message == nullptr) {
+      // sent with the next flush, unless they are dropped meanwhile
+      return;
+    }
+    if (this->droppedLines > 0) {
+      this->logSocket.printfAll("W [Logger] %u lines dropped before sending them.\n", this->droppedLines);
+    }
+    this->logSocket.textAll(message);
+  }
+  this->droppedLines = 0;
+  this->flushed = this->head;
+}
+
+void LoggerClass::handle() {
+  this->logSocket.cleanupClients();
+
+  uint32_t now = millis();
+  // lines printed without a newline are sent on their own after a while
+  if (this->lineLength > 0 && now - this->lineStartMillis >= LOG_FLUSH_INTERVAL_MILLIS) {
+    this->commitLine();
+  }
+  if (now - this->lastFlushMillis >= LOG_FLUSH_INTERVAL_MILLIS) {
+    this->flush();
+    this->lastFlushMillis = now;
+  }
+}
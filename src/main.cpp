@@ -8,13 +8,19 @@
 #include <vector>
 #include <WiFiClientSecureBearSSL.h>
 
+#include "clock.h"
 #include "config.h"
 #include "persistent_config.h"
+#include "crash_trace.h"
+#include "heap_stats.h"
 #include "logger.h"
+#include "metrics.h"
+#include "profiler.h"
 #include "catalog.h"
 #include "recorder.h"
 #include "scales.h"
 #include "webserver.h"
+#include "wifi_connection.h"
 
 Config config;
 PersistentConfig persistentConfig;
@@ -24,7 +30,9 @@ BrewfatherCatalog catalog;
 Recorder recorder;
 
 Scales scales;
+WiFiConnection wifiConnection;
 WebServer *server;
+bool isNetworkStarted = false;
 
 void failSetup(const char *message) {
   Serial.print(message);
@@ -44,32 +52,12 @@ void setupConfig() {
     failSetup("Loading config failed!");
   }
 
-  persistentConfig.load(config.scales.size());
+  persistentConfig.load(config.scales);
 }
 
 void setupWiFi() {
-  WiFi.mode(WIFI_STA);
-  WiFi.disconnect();
-  delay(100);
-
-  int numNetworks = WiFi.scanNetworks();
-  int numSSIDs = config.wifis.size();
-  for (int i = 0; i < numNetworks; ++i) {
-    for (int j = 0; j < numSSIDs; ++j) {
-      if (String(config.wifis[j].ssid) == WiFi.SSID(i)) {
-        WiFi.begin(config.wifis[j].ssid, config.wifis[j].passphrase);
-        if (WiFi.waitForConnectResult() == WL_CONNECTED) {
-          break;
-        }
-      }
-    }
-  }
-  if (WiFi.status() != WL_CONNECTED) {
-    failSetup("WiFi connection failed!");
-  }
-  Serial.print("WiFi connected. IP address: ");
-  Serial.print(WiFi.localIP());
-  Serial.println(".");
+  // only starts connecting, the network services are started from the loop once connected
+  wifiConnection.begin(config.wifis);
 }
 
 void setupOTA() {
@@ -120,12 +108,8 @@ void setupOTA() {
   ArduinoOTA.begin();
 }
 
-void setupDateTime() {
-  DateTime.setTimeZone("UTC0");
-  DateTime.begin();
-  if (!DateTime.isTimeValid()) {
-    failSetup("Failed to get time from server!");
-  }
+void setupClock() {
+  Clock.begin();
 }
 
 void setupSslClient() {
@@ -145,6 +129,7 @@ void setupRecorder() {
 }
 
 void setupScales() {
+  Metrics.begin(config.scales.size());
   scales.begin(config, persistentConfig, recorder);
   Serial.println("Scales initialized.");
 }
@@ -155,30 +140,68 @@ void setupHTTP() {
   Serial.println("HTTP server started.");
 }
 
+void setupNetwork() {
+  setupOTA();
+  Clock.startSync();
+  setupHTTP();
+  isNetworkStarted = true;
+  Serial.println("Network services started.");
+}
+
+// The scales start measuring from the persisted state right away,
+// and everything depending on the network follows once it is up.
 void setup() {
+  CrashTrace.begin();
   Serial.begin(115200);
   Serial.println("Booting...");
 
   setupFS();
   setupConfig();
+  setupClock();
+  setupRecorder();
+  setupScales();
   setupWiFi();
-  setupOTA();
-  setupDateTime();
   setupSslClient();
   setupCatalog();
-  setupRecorder();
-  setupScales();
-  setupHTTP();
 
   Serial.println("Setup finished at " + DateTime.toString());
 }
 
 void loop() {
-  ArduinoOTA.handle();
+  PROFILE_LOOP();
+  {
+    PROFILE_PHASE(Network);
+    CrashTrace.setPhase(TracedPhase::Network);
+    wifiConnection.handle();
+    if (!isNetworkStarted && wifiConnection.isConnected()) {
+      setupNetwork();
+    }
+    Clock.handle();
+  }
   yield();
-  catalog.handle();
+  if (isNetworkStarted) {
+    PROFILE_PHASE(Ota);
+    CrashTrace.setPhase(TracedPhase::Ota);
+    ArduinoOTA.handle();
+  }
   yield();
-  scales.handle();
+  {
+    PROFILE_PHASE(Catalog);
+    CrashTrace.setPhase(TracedPhase::Catalog);
+    catalog.handle();
+  }
   yield();
-  Logger.handle();
+  {
+    PROFILE_PHASE(Scales);
+    CrashTrace.setPhase(TracedPhase::Scales);
+    scales.handle();
+  }
+  yield();
+  {
+    PROFILE_PHASE(Logger);
+    CrashTrace.setPhase(TracedPhase::Logger);
+    Logger.handle();
+    HeapStats.handle();
+  }
+  CrashTrace.setPhase(TracedPhase::System);
 }
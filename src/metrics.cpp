@@ -0,0 +1,3 @@
+#include "metrics.h"
+
+MetricsClass Metrics;
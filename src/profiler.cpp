@@ -0,0 +1,11 @@
+#include "profiler.h"
+
+#ifdef ENABLE_LOOP_PROFILER
+
+const uint32_t LatencyHistogram::bucketLimitsMicros[PROFILER_NUM_BUCKETS - 1] = {
+  100, 250, 500, 1000, 2500, 5000, 10000, 25000, 100000
+};
+
+ProfilerClass Profiler;
+
+#endif
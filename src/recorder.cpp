@@ -0,0 +1,3 @@
+#include "recorder.h"
+
+SlotArena RecordingArena("recordings", HeapTag::Recorder, sizeof(RecordingEntry));
@@ -1,5 +1,8 @@
 #include "scale.h"
+#include "crash_trace.h"
 #include "logger.h"
+#include "metrics.h"
+#include "profiler.h"
 
 #define btoa(x) ((x)?"true":"false")
 
@@ -10,6 +13,7 @@ void Scale::begin() {
 
 UpdateResult Scale::update() {
   if (this->nextState != nullptr) {
+    ++Metrics.forScale(this->index).stateTransitions;
     if (this->currentState != nullptr) {
       this->currentState->exit(this->nextState);
     }
@@ -18,6 +22,7 @@ UpdateResult Scale::update() {
     this->currentState = this->nextState;
     this->nextState = nullptr;
     this->currentState->enter(this, prevState);
+    CrashTrace.recordScaleState(this->index, this->currentState->getName());
     // It is expected that we create new objects for nextState each time,
     // hence we need to destroy the previous state here.
     if (prevState != nullptr) {
@@ -26,6 +31,7 @@ UpdateResult Scale::update() {
     yield();
     return UpdateResult::StateChange;
   } else {
+    PROFILE_SCALE_STATE(this->currentState->getName());
     return this->currentState->update()
       ? UpdateResult::StateUpdate
       : UpdateResult::None;
@@ -33,12 +39,14 @@ UpdateResult Scale::update() {
 }
 
 void Scale::setState(ScaleState *newState) {
-  // the actual state change is done on update()
+  // the actual state change is done on update(), replacing the one which is still pending,
+  // which frees the recording entry of a replaced recording state
+  delete this->nextState;
   this->nextState = newState;
 }
 
-bool Scale::startRecorder(TapEntry *tapEntry) {
-  return this->recorder.start(this->index, tapEntry, this->getAdcData());
+bool Scale::startRecorder(RecordingEntry *newEntry) {
+  return this->recorder.start(this->index, newEntry, this->getAdcData());
 }
 
 bool Scale::putRecordingEntry(RecordingEntry *recordingEntry) {
@@ -57,35 +65,50 @@ bool Scale::updateRecorder() {
   return this->recorder.update(this->index, this->getAdcData());
 }
 
-void Scale::renderRecorder(JsonObject &obj, bool isFull) {
-  this->recorder.render(this->index, obj, isFull);
+bool Scale::isRecorderPaused() {
+  return this->recorder.isPaused(this->index);
 }
 
-void Scale::render(JsonDocument &doc, bool isFull) {
-  doc["index"] = this->index;
-  doc["isFull"] = isFull;
+void Scale::renderRecorderData(JsonWriter &writer) {
+  this->recorder.renderData(this->index, writer, this->renderSince);
+}
+
+void Scale::renderRecorderDetails(JsonWriter &writer, bool isFull) {
+  this->recorder.renderDetails(this->index, writer, isFull);
+}
+
+void Scale::render(JsonWriter &writer, bool isFull, time_t since) {
+  writer.member("index", this->index);
+  writer.member("isFull", isFull);
 
-  JsonObject state = doc.createNestedObject("state");
-  this->currentState->render(state, isFull);
+  this->renderSince = since;
+  writer.beginObject("state");
+  this->currentState->render(writer, isFull);
+  writer.endObject();
 
 #ifdef RENDER_SCALE_ADC_FOR_DEBUG
-  JsonObject adc = doc.createNestedObject("adc");
-  adc["tareOffset"] = this->adc.getTareOffset();
-  adc["calibrationFactor"] = this->adc.getCalFactor();
+  writer.beginObject("adc");
+  writer.member("tareOffset", this->adc.getTareOffset());
+  writer.member("calibrationFactor", this->adc.getCalFactor());
 
-  adc["samplesPerSecond"] = this->adc.getSPS();
-  adc["conversionTime"] = this->adc.getConversionTime();
+  writer.member("samplesPerSecond", this->adc.getSPS());
+  writer.member("conversionTime", this->adc.getConversionTime());
 
-  adc["samplesInUse"] = this->adc.getSamplesInUse();
-  adc["settlingTime"] = this->adc.getSettlingTime();
-  adc["readIndex"] = this->adc.getReadIndex();
-  adc["dataSetStatus"] = this->adc.getDataSetStatus();
+  writer.member("samplesInUse", this->adc.getSamplesInUse());
+  writer.member("settlingTime", this->adc.getSettlingTime());
+  writer.member("readIndex", this->adc.getReadIndex());
+  writer.member("dataSetStatus", this->adc.getDataSetStatus());
 
-  adc["tareTimeoutFlag"] = this->adc.getTareTimeoutFlag();
-  adc["signalTimeoutFlag"] = this->adc.getSignalTimeoutFlag();
+  writer.member("tareTimeoutFlag", this->adc.getTareTimeoutFlag());
+  writer.member("signalTimeoutFlag", this->adc.getSignalTimeoutFlag());
+  writer.endObject();
 #endif
 }
 
+bool Scale::canResume(uint32_t recordingId, time_t since) {
+  // the state might not show the recording, e.g. when the scale went offline
+  return this->currentState->isRecording() && this->recorder.canResume(this->index, recordingId, since);
+}
 
 void Scale::standby() {
   Logger.printf("[Scale] Set scale %d to standby mode.\n", this->index);
@@ -107,14 +130,14 @@ void Scale::calibrate(float knownMass) {
   this->setState(new CalibrateScaleState(knownMass));
 }
 
-void Scale::startRecording(TapEntry *tapEntry) {
-  Logger.printf("[Scale] Recording on scale %d for batch %s.\n", this->index, tapEntry->name);
-  this->setState(new RecordingScaleState(tapEntry));
+void Scale::startRecording(RecordingEntry *newEntry) {
+  Logger.printf("[Scale] Recording on scale %d for batch %s.\n", this->index, newEntry->tapEntry.name);
+  this->setState(new RecordingScaleState(newEntry, false));
 }
 
-void Scale::startRecording(RecordingEntry *recordingEntry) {
-  Logger.printf("[Scale] Recording on scale %d for batch %s.\n", this->index, recordingEntry->tapEntry.name);
-  this->setState(new RecordingScaleState(recordingEntry));
+void Scale::restoreRecording(RecordingEntry *uploadedEntry) {
+  Logger.printf("[Scale] Recording on scale %d for batch %s.\n", this->index, uploadedEntry->tapEntry.name);
+  this->setState(new RecordingScaleState(uploadedEntry, true));
 }
 
 void Scale::pauseRecording() {
@@ -140,6 +163,10 @@ void Scale::startAdc() {
 
 uint8_t Scale::updateAdc() {
   uint8_t updateResult = this->adc.update();
+  ScaleMetrics &metrics = Metrics.forScale(this->index);
+  if (updateResult) {
+    ++metrics.adcSamples;
+  }
 
   bool isSignalTimeout = this->adc.getSignalTimeoutFlag();
   bool isTareTimeout = this->adc.getTareTimeoutFlag();
@@ -154,6 +181,9 @@ uint8_t Scale::updateAdc() {
       btoa(isTareTimeout)
     );
     this->adcOnlineFlag = newOnlineFlag;
+    if (isSignalTimeout) {
+      ++metrics.signalTimeouts;
+    }
   }
 
   return updateResult;
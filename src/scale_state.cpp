@@ -17,45 +17,46 @@ bool OnlineScaleState::update() {
   return false;
 }
 
-void OnlineScaleState::render(JsonObject &state, bool isFull) const {
-  state["data"] = this->scale->getAdcData();
+void OnlineScaleState::render(JsonWriter &writer, bool isFull) const {
+  writer.member("data", this->scale->getAdcData());
 }
 
-void StandbyScaleState::render(JsonObject &state, bool isFull) const {
-  OnlineScaleState::render(state, isFull);
-  state["name"] = "standby";
+void StandbyScaleState::render(JsonWriter &writer, bool isFull) const {
+  OnlineScaleState::render(writer, isFull);
+  writer.member("name", "standby");
 }
 
 void LiveMeasurementScaleState::enter(Scale *scale, ScaleState *prevState) {
   OnlineScaleState::enter(scale, prevState);
-  this->lastRefresh = 0;
+  // due right away
+  this->lastRefreshMillis = millis() - LIVE_MEASUREMENT_REFRESH_MILLIS;
 }
 
 bool LiveMeasurementScaleState::update() {
   OnlineScaleState::update();
 
-  time_t now = DateTime.now();
-  time_t elapsed = now - this->lastRefresh;
-
-  if (elapsed >= LIVE_MEASUREMENT_REFRESH_SECONDS) {
-    this->lastRefresh = now;
+  uint32_t now = millis();
+  if (now - this->lastRefreshMillis >= LIVE_MEASUREMENT_REFRESH_MILLIS) {
+    this->lastRefreshMillis = now;
     return true;
   }
 
   return false;
 }
 
-void LiveMeasurementScaleState::render(JsonObject &state, bool isFull) const {
-  OnlineScaleState::render(state, isFull);
-  state["name"] = "liveMeasurement";
+void LiveMeasurementScaleState::render(JsonWriter &writer, bool isFull) const {
+  OnlineScaleState::render(writer, isFull);
+  writer.member("name", "liveMeasurement");
 }
 
 void RecordingScaleState::enter(Scale *scale, ScaleState *prevState) {
   OnlineScaleState::enter(scale, prevState);
-  if (this->recordingEntry != nullptr) {
-    this->scale->putRecordingEntry(this->recordingEntry);
+  RecordingEntry *entry = this->recordingEntry;
+  this->recordingEntry = nullptr;
+  if (this->isUploaded) {
+    this->scale->putRecordingEntry(entry);
   } else {
-    this->scale->startRecorder(this->tapEntry);
+    this->scale->startRecorder(entry);
   }
 }
 
@@ -64,11 +65,16 @@ bool RecordingScaleState::update() {
   return this->scale->updateRecorder();
 }
 
-void RecordingScaleState::render(JsonObject &state, bool isFull) const {
-  OnlineScaleState::render(state, isFull);
-  state["name"] = "recording";
-  state["isPaused"] = false;
-  this->scale->renderRecorder(state, isFull);
+void RecordingScaleState::render(JsonWriter &writer, bool isFull) const {
+  this->renderRecording(writer, isFull, this->scale->isRecorderPaused());
+}
+
+void RecordingScaleState::renderRecording(JsonWriter &writer, bool isFull, bool isPaused) const {
+  // the recorded data takes the place of the live measurement
+  this->scale->renderRecorderData(writer);
+  writer.member("name", "recording");
+  writer.member("isPaused", isPaused);
+  this->scale->renderRecorderDetails(writer, isFull);
 }
 
 void PausedRecordingScaleState::enter(Scale *scale, ScaleState *prevState) {
@@ -76,9 +82,8 @@ void PausedRecordingScaleState::enter(Scale *scale, ScaleState *prevState) {
   this->scale->pauseRecorder();
 }
 
-void PausedRecordingScaleState::render(JsonObject &state, bool isFull) const {
-  RecordingScaleState::render(state, isFull);
-  state["isPaused"] = true;
+void PausedRecordingScaleState::render(JsonWriter &writer, bool isFull) const {
+  this->renderRecording(writer, isFull, true);
 }
 
 void StopRecordingScaleState::enter(Scale *scale, ScaleState *prevState) {
@@ -92,9 +97,9 @@ bool StopRecordingScaleState::update() {
   return OnlineScaleState::update();
 }
 
-void StopRecordingScaleState::render(JsonObject &state, bool isFull) const {
-  OnlineScaleState::render(state, isFull);
-  state["name"] = "recording";
+void StopRecordingScaleState::render(JsonWriter &writer, bool isFull) const {
+  OnlineScaleState::render(writer, isFull);
+  writer.member("name", "recording");
 }
 
 void TareScaleState::enter(Scale *scale, ScaleState *prevState) {
@@ -110,9 +115,9 @@ bool TareScaleState::update() {
   return false;
 }
 
-void TareScaleState::render(JsonObject &state, bool isFull) const {
-  OnlineScaleState::render(state, isFull);
-  state["name"] = "tare";
+void TareScaleState::render(JsonWriter &writer, bool isFull) const {
+  OnlineScaleState::render(writer, isFull);
+  writer.member("name", "tare");
 }
 
 void CalibrateScaleState::enter(Scale *scale, ScaleState *prevState) {
@@ -126,10 +131,10 @@ bool CalibrateScaleState::update() {
   return false;
 }
 
-void CalibrateScaleState::render(JsonObject &state, bool isFull) const {
-  OnlineScaleState::render(state, isFull);
-  state["name"] = "calibrate";
-  state["knownMass"] = this->knownMass;
+void CalibrateScaleState::render(JsonWriter &writer, bool isFull) const {
+  OnlineScaleState::render(writer, isFull);
+  writer.member("name", "calibrate");
+  writer.member("knownMass", this->knownMass);
 }
 
 void OfflineScaleState::enter(Scale *scale, ScaleState *prevState) {
@@ -150,6 +155,6 @@ bool OfflineScaleState::update() {
   return false;
 }
 
-void OfflineScaleState::render(JsonObject &state, bool isFull) const {
-  state["name"] = "offline";
+void OfflineScaleState::render(JsonWriter &writer, bool isFull) const {
+  writer.member("name", "offline");
 }
@@ -35,8 +35,14 @@ export default function MainTabs() {
         console.warn('Log socket error.', e);
       };
 
+      // messages are batches of lines, each one starting with its level
       logSocket.onmessage = e => {
-        console.debug(`[${new Date().toLocaleString()}] ${e.data}`);
+        const timestamp = new Date().toLocaleString();
+        for (const line of e.data.split("\n")) {
+          if (line != "") {
+            console.debug(`[${timestamp}] ${line}`);
+          }
+        }
       };
 
       return () => {
@@ -20,9 +20,13 @@ import LoadingIndicator from './LoadingIndicator';
 
 import BuildIcon from '@mui/icons-material/Build';
 import DeveloperBoardIcon from '@mui/icons-material/DeveloperBoard';
+import HistoryIcon from '@mui/icons-material/History';
 import MemoryIcon from '@mui/icons-material/Memory';
+import PieChartIcon from '@mui/icons-material/PieChart';
 import SdCardIcon from '@mui/icons-material/SdCard';
+import SpeedIcon from '@mui/icons-material/Speed';
 import StorageIcon from '@mui/icons-material/Storage';
+import ViewModuleIcon from '@mui/icons-material/ViewModule';
 import WifiIcon from '@mui/icons-material/Wifi';
 
 const groups = {
@@ -38,6 +42,14 @@ const groups = {
     label: "Heap",
     icon: MemoryIcon
   },
+  heapUsage: {
+    label: "Heap usage",
+    icon: PieChartIcon
+  },
+  arenas: {
+    label: "Arenas",
+    icon: ViewModuleIcon
+  },
   fs: {
     label: "File system",
     icon: StorageIcon
@@ -121,6 +133,10 @@ const stats = {
     label: "Free DRAM heap",
     show: formatBytes
   },
+  maxFreeDramBlock: {
+    label: "Largest free DRAM block",
+    show: formatBytes
+  },
   dramHeapFragmentation: {
     label: "DRAM heap fragmentation",
     show: integerPercentage
@@ -129,10 +145,26 @@ const stats = {
     label: "Free IRAM heap",
     show: formatBytes
   },
+  maxFreeIramBlock: {
+    label: "Largest free IRAM block",
+    show: formatBytes
+  },
   iramHeapFragmentation: {
     label: "IRAM heap fragmentation",
     show: integerPercentage
   },
+  minFreeDramHeap: {
+    label: "Lowest free DRAM heap",
+    show: formatBytes
+  },
+  minFreeIramHeap: {
+    label: "Lowest free IRAM heap",
+    show: formatBytes
+  },
+  untrackedMessageBuffers: {
+    label: "Untracked message buffers",
+    show: identity
+  },
   totalBytes: {
     label: "Total bytes",
     show: formatBytes
@@ -151,6 +183,55 @@ const stats = {
   },
 }
 
+const perfLabels = {
+  loop: "Loop",
+  network: "Network",
+  ota: "OTA",
+  catalog: "Catalog",
+  scales: "Scales",
+  logger: "Logger",
+};
+
+const showMicros = (us) => us >= 1000 ? (us / 1000).toFixed(1) + " ms" : us + " µs";
+
+const showHistogram = (latency, bucketLimitsMicros) => {
+  const buckets = latency.histogram
+    .map((count, i) => {
+      const limit = i < bucketLimitsMicros.length
+        ? "≤" + showMicros(bucketLimitsMicros[i])
+        : ">" + showMicros(bucketLimitsMicros[i - 1]);
+      return count > 0 ? limit + ": " + count : null;
+    })
+    .filter(Boolean);
+  return "mean " + showMicros(latency.meanMicros)
+    + ", max " + showMicros(latency.maxMicros)
+    + " (" + buckets.join(", ") + ")";
+};
+
+const showArena = (arena) => arena.usedSlots + " of " + arena.numSlots
+  + " slots of " + formatBytes(arena.slotSize) + " used (peak " + arena.peakUsedSlots + "), "
+  + arena.fallbacks + " fallback allocations";
+
+const heapUsageLabels = {
+  recorder: "Recorder",
+  webSocket: "WebSocket buffers",
+  catalog: "Catalog",
+  json: "JSON documents",
+  webRequests: "Web requests",
+};
+
+const showHeapUsage = (usage) => formatBytes(usage.currentBytes) + " (peak " + formatBytes(usage.peakBytes) + ")";
+
+// arenas are listed by their names, and the heap usage by the subsystems
+const getStat = (group, stat) => {
+  if (group == "arenas") {
+    return { label: stat, show: showArena };
+  } else if (group == "heapUsage") {
+    return { label: heapUsageLabels[stat] || stat, show: showHeapUsage };
+  }
+  return stats[stat];
+};
+
 function ListItemCopyButton(props) {
   const [showCopyDone, setShowCopyDone] = React.useState(false);
 
@@ -188,8 +269,8 @@ function StatusContents({ data }) {
                     <ListItem disablePadding>
                       <ListItemCopyButton sx={{ pl: 4 }}>
                         <ListItemText
-                          primary={stats[stat].label}
-                          secondary={stats[stat].show(data[group][stat])}
+                          primary={getStat(group, stat).label}
+                          secondary={getStat(group, stat).show(data[group][stat])}
                         />
                       </ListItemCopyButton>
                     </ListItem>
@@ -205,9 +286,103 @@ function StatusContents({ data }) {
   );
 }
 
+function PerfItem({ label, latency, bucketLimitsMicros }) {
+  return (
+    <React.Fragment>
+      <ListItem disablePadding>
+        <ListItemCopyButton sx={{ pl: 4 }}>
+          <ListItemText
+            primary={label}
+            secondary={showHistogram(latency, bucketLimitsMicros)}
+          />
+        </ListItemCopyButton>
+      </ListItem>
+      <Divider />
+    </React.Fragment>
+  );
+}
+
+// only available when the firmware is built with the loop profiler
+function PerfContents({ data }) {
+  return (
+    <List>
+      <ListItem>
+        <ListItemIcon sx={{ minWidth: "36px" }}><SpeedIcon /></ListItemIcon>
+        <ListItemText primary="Performance" secondary={data.loop.loopsPerSecond + " loops/s"} />
+      </ListItem>
+      <Divider />
+      <List component="div" disablePadding>
+        <PerfItem label={perfLabels.loop} latency={data.loop} bucketLimitsMicros={data.bucketLimitsMicros} />
+        {Object.keys(data.phases).map((phase) => (
+          <PerfItem
+            key={"phase." + phase}
+            label={perfLabels[phase]}
+            latency={data.phases[phase]}
+            bucketLimitsMicros={data.bucketLimitsMicros} />
+        ))}
+        {Object.keys(data.scaleStates).map((state) => (
+          <PerfItem
+            key={"scaleState." + state}
+            label={"Scale state: " + state}
+            latency={data.scaleStates[state]}
+            bucketLimitsMicros={data.bucketLimitsMicros} />
+        ))}
+      </List>
+    </List>
+  );
+}
+
+function LastCrashItem({ label, value }) {
+  return (
+    <React.Fragment>
+      <ListItem disablePadding>
+        <ListItemCopyButton sx={{ pl: 4 }}>
+          <ListItemText primary={label} secondary={value} />
+        </ListItemCopyButton>
+      </ListItem>
+      <Divider />
+    </React.Fragment>
+  );
+}
+
+// the trace of the previous run is missing after a power loss
+function LastCrashContents({ data }) {
+  const trace = data.trace;
+  return (
+    <List>
+      <ListItem>
+        <ListItemIcon sx={{ minWidth: "36px" }}><HistoryIcon /></ListItemIcon>
+        <ListItemText primary="Last reset" secondary={data.resetReason} />
+      </ListItem>
+      <Divider />
+      {trace && (
+        <List component="div" disablePadding>
+          <LastCrashItem
+            label="Loop phase"
+            value={trace.phase + " (" + (trace.phaseMillis / 1000).toFixed(1) + " s after boot)"} />
+          {trace.scales.map((scale) => (
+            <LastCrashItem
+              key={"scale." + scale.index}
+              label={"Scale " + scale.index}
+              value={scale.state + (scale.recordingId ? ", recording " + scale.recordingId + " at " + scale.recordingValue : "")} />
+          ))}
+          {trace.log.map((event, i) => (
+            <LastCrashItem
+              key={"log." + i}
+              label={"Log at " + (event.millis / 1000).toFixed(1) + " s"}
+              value={event.line} />
+          ))}
+        </List>
+      )}
+    </List>
+  );
+}
+
 export default function StatusPanel({ debugLog, setDebugLog }) {
 
   const { isLoading, data, error } = useFetch(apiLocation("/status"));
+  const perf = useFetch(apiLocation("/status/perf"));
+  const lastCrash = useFetch(apiLocation("/status/last-crash"));
 
   const handleDebugLogChange = (e) => {
     setDebugLog(e.currentTarget.checked);
@@ -221,6 +396,8 @@ export default function StatusPanel({ debugLog, setDebugLog }) {
         sx={{m: 1}} />
       <Divider />
       { isLoading ? <LoadingIndicator /> : (error ? <ErrorIndicator error={error} /> : <StatusContents data={data} />)}
+      { !perf.isLoading && !perf.error && perf.data && <PerfContents data={perf.data} /> }
+      { !lastCrash.isLoading && !lastCrash.error && lastCrash.data && <LastCrashContents data={lastCrash.data} /> }
     </Stack>
   );
 }
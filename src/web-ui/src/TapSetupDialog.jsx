@@ -59,15 +59,32 @@ export default function TapSetupDialog({ scale, weights, open, onClose }) {
     }
   };
 
+  // the update runs in the background, hence wait until the catalog is idle again
+  const waitForCatalogRefresh = () => {
+    return new Promise((resolve) => setTimeout(resolve, 1000))
+      .then(() => fetch(apiLocation("/catalog")))
+      .then((response) => response.json())
+      .then((catalog) => catalog.refresh.state == "idle" ? catalog : waitForCatalogRefresh());
+  };
+
   const handleCatalogRefresh = () => {
-    fetch(apiLocation("/catalog/update"), { method: "POST" }).then((response) => {
-      if (response.ok) {
+    fetch(apiLocation("/catalog/update"), { method: "POST" })
+      .then((response) => {
+        if (!response.ok) {
+          throw response.statusText;
+        }
+        return waitForCatalogRefresh();
+      })
+      .then((catalog) => {
+        if (catalog.lastErrorMessage) {
+          throw catalog.lastErrorMessage;
+        }
         setFeedback({ isOpen: true, message: 'Catalog update complete!', severity: 'success' });
         catalogRefreshTrigger();
-      } else {
+      })
+      .catch(() => {
         setFeedback({ isOpen: true, message: 'Catalog update failed!', severity: 'error' });
-      }
-    })
+      });
   };
 
   const handleFeedbackClose = () => {
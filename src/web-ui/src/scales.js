@@ -87,8 +87,11 @@ export default class Scales {
 
   #instances;
   #socket;
+  #cursors = [];
   #commandQueue = [];
-  #executingCommand = null;
+  #pendingCommands = new Map();
+  #sentCommandIds = new Set();
+  #nextCommandId = 1;
 
   constructor(url, fullConfig, ondata) {
     this.#url = url;
@@ -101,20 +104,19 @@ export default class Scales {
 
   open() {
     console.info("Opening scales socket...");
-    this.#socket = new ReconnectingWebSocket(this.#url);
+    // the URL is evaluated on each reconnect, so only missing data gets resent
+    this.#socket = new ReconnectingWebSocket(() => this.#resumeUrl());
 
     this.#socket.onopen = () => {
       console.info("Scales socket open.");
-      this.#scheduleNextCommand();
+      this.#sendQueuedCommands();
     };
 
     this.#socket.onerror = (e) => {
-      if (this.#hasExecutingCommand()) {
-        this.#executingCommand.promise.reject(e);
-        this.#executingCommand = null;
-        this.#scheduleNextCommand();
-      } else {
-        console.warn("Scales socket error.", e);
+      console.warn("Scales socket error.", e);
+      // responses for the commands already sent are lost with the connection
+      for (const id of this.#sentCommandIds) {
+        this.#pendingCommands.get(id).reject(e);
       }
     };
 
@@ -125,26 +127,19 @@ export default class Scales {
         return;
       }
 
-      if (payload.type == "ack") {
-        if (!this.#hasExecutingCommand()) {
-          console.warn(
-            "Scale command acknowledged without execution.",
-            payload
-          );
-          return;
-        }
-        this.#executingCommand.promise.resolve();
-        this.#executingCommand = null;
-        this.#scheduleNextCommand();
-      } else if (payload.type == "error") {
-        if (!this.#hasExecutingCommand()) {
-          console.warn("Scale command failed without execution.", payload);
+      if (
+        payload.type == "ack" ||
+        payload.type == "error" ||
+        payload.type == "results"
+      ) {
+        const command = this.#pendingCommands.get(payload.id);
+        if (command === undefined) {
+          console.warn("Scale command response without execution.", payload);
           return;
         }
-        this.#executingCommand.promise.reject(payload.message);
-        this.#executingCommand = null;
-        this.#scheduleNextCommand();
+        command.resolve(payload);
       } else if (payload.type == "data") {
+        this.#updateCursor(payload);
         this.#ondata(payload);
       } else {
         console.warn("Unexpected scale message type: " + payload.type);
@@ -153,13 +148,8 @@ export default class Scales {
   }
 
   close() {
+    // queued commands are kept, and they are sent once the socket is open again
     this.#socket.close();
-
-    if (this.#hasExecutingCommand()) {
-      this.#queueCommand(this.#executingCommand);
-      this.#executingCommand = null;
-    }
-
     console.info("Scales socket closed.");
   }
 
@@ -168,30 +158,92 @@ export default class Scales {
   }
 
   sendCommand(payload) {
-    const promise = new PromiseController({ timeout: 10000 });
-    const command = { payload: payload, promise: promise };
-    return promise.call(() => {
-      this.#queueCommand(command);
-      this.#scheduleNextCommand();
+    return this.#send(payload).then((response) => {
+      if (response.type == "error") {
+        throw response.message;
+      }
     });
   }
 
-  #queueCommand(command) {
-    this.#commandQueue.push(command);
+  // Sends all commands in a single message, e.g. to tare all scales at once.
+  // Resolves with a result for each command: either an ack or an error with its message.
+  sendCommands(payloads) {
+    return this.#send({ commands: payloads }).then((response) => {
+      if (response.type == "error") {
+        throw response.message;
+      }
+      return response.results;
+    });
   }
 
-  #hasExecutingCommand() {
-    return this.#executingCommand != null;
+  #resumeUrl() {
+    const cursors = this.#instances.map((_, index) => {
+      const cursor = this.#cursors[index];
+      return cursor === undefined ? "" : cursor.recordingId + ":" + cursor.since;
+    });
+    return cursors.some((cursor) => cursor != "")
+      ? this.#url + "?resume=" + cursors.join(",")
+      : this.#url;
   }
 
-  #scheduleNextCommand() {
-    if (!this.#hasExecutingCommand() && this.#commandQueue.length > 0) {
-      this.#executeCommand(this.#commandQueue.shift());
+  #updateCursor(payload) {
+    const state = payload.state;
+    if (state === undefined || state.recordingId === undefined) {
+      if (payload.isFull) {
+        delete this.#cursors[payload.index];
+      }
+      return;
+    }
+
+    const previous = this.#cursors[payload.index];
+    let since =
+      !payload.isFull &&
+      previous !== undefined &&
+      previous.recordingId == state.recordingId
+        ? previous.since
+        : 0;
+    for (const timestamp in state.data) {
+      since = Math.max(since, Number(timestamp));
+    }
+
+    if (since > 0) {
+      this.#cursors[payload.index] = {
+        recordingId: state.recordingId,
+        since: since,
+      };
+    } else {
+      delete this.#cursors[payload.index];
     }
   }
 
-  #executeCommand(command) {
-    this.#executingCommand = command;
-    this.#socket.send(JSON.stringify(command.payload));
+  #send(message) {
+    // commands are identified, so they can be sent without waiting for the previous responses
+    const id = this.#nextCommandId++;
+    const promise = new PromiseController({ timeout: 10000 });
+    this.#pendingCommands.set(id, promise);
+    return promise
+      .call(() => {
+        this.#commandQueue.push({ ...message, id: id });
+        this.#sendQueuedCommands();
+      })
+      .finally(() => {
+        this.#pendingCommands.delete(id);
+        this.#sentCommandIds.delete(id);
+      });
+  }
+
+  #sendQueuedCommands() {
+    if (
+      this.#socket === undefined ||
+      this.#socket.readyState != ReconnectingWebSocket.OPEN
+    ) {
+      return;
+    }
+
+    while (this.#commandQueue.length > 0) {
+      const command = this.#commandQueue.shift();
+      this.#socket.send(JSON.stringify(command));
+      this.#sentCommandIds.add(command.id);
+    }
   }
 }
@@ -1,4 +1,6 @@
+const fs = require('fs');
 const path = require('path');
+const webpack = require('webpack');
 const express = require('express');
 const TerserPlugin = require('terser-webpack-plugin');
 const CopyWebpackPlugin = require('copy-webpack-plugin');
@@ -8,6 +10,26 @@ const ReactRefreshWebpackPlugin = require('@pmmmwh/react-refresh-webpack-plugin'
 const outputPath = path.resolve(__dirname, '../../data/html/');
 const isDevelopment = process.env.NODE_ENV !== 'production';
 
+// Emits index.html with the (content hashed) bundles of the entry point.
+// It runs after the real content hashes are assigned to the file names.
+class IndexHtmlPlugin {
+  apply(compiler) {
+    compiler.hooks.thisCompilation.tap('IndexHtmlPlugin', (compilation) => {
+      compilation.hooks.processAssets.tap(
+        { name: 'IndexHtmlPlugin', stage: webpack.Compilation.PROCESS_ASSETS_STAGE_ANALYSE },
+        () => {
+          const scripts = compilation.entrypoints.get('app').getFiles()
+            .filter((file) => file.endsWith('.js'))
+            .map((file) => `<script defer src="${file}"></script>`)
+            .join('\n    ');
+          const template = fs.readFileSync(path.resolve(__dirname, 'public/index.html'), 'utf8');
+          compilation.emitAsset('index.html', new webpack.sources.RawSource(template.replace('<!-- scripts -->', scripts)));
+        }
+      );
+    });
+  }
+}
+
 module.exports = {
   entry: {
     app: './src/index.jsx'
@@ -47,7 +69,9 @@ module.exports = {
   output: {
     path: outputPath,
     publicPath: '',
-    filename: '[name].js'
+    // hashed bundles are served with immutable caching, see stamp_fs.py for their compression
+    filename: isDevelopment ? '[name].js' : 'static/[name].[contenthash:8].js',
+    clean: true
   },
   optimization: {
     minimize: true,
@@ -95,9 +119,10 @@ module.exports = {
   plugins: [
     new CopyWebpackPlugin({
       patterns: [
-        { from: 'public' }
+        { from: 'public', globOptions: { ignore: ['**/index.html'] } }
       ]
     }),
+    new IndexHtmlPlugin(),
     new ESLintPlugin(),
     isDevelopment && new ReactRefreshWebpackPlugin(),
   ].filter(Boolean),
@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <LittleFS.h>
+
+#include "logger.h"
+#include "wifi_connection.h"
+
+void WiFiConnection::begin(const std::vector<WiFiConfig> &_wifis) {
+  this->wifis = &_wifis;
+
+  // the SDK would write its own copy of the settings to flash on each begin()
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(true);
+
+  File file = LittleFS.open(WIFI_CACHE_PATH, "r");
+  bool isCached = file
+    && file.read((uint8_t *) &this->cache, sizeof(this->cache)) == sizeof(this->cache)
+    && this->cache.magic == WIFI_CACHE_MAGIC;
+  if (file) {
+    file.close();
+  }
+
+  int wifiIndex = -1;
+  if (isCached) {
+    this->cache.ssid[sizeof(this->cache.ssid) - 1] = 0;
+    wifiIndex = this->findWifi(this->cache.ssid);
+  }
+  if (wifiIndex < 0) {
+    memset(&this->cache, 0, sizeof(this->cache));
+    this->startScan();
+    return;
+  }
+
+  Logger.printf("[WiFi] Connecting to %s on channel %d.\n", this->cache.ssid, this->cache.channel);
+  const WiFiConfig &wifi = (*this->wifis)[wifiIndex];
+  WiFi.begin(wifi.ssid, wifi.passphrase, this->cache.channel, this->cache.bssid);
+  this->setState(WiFiConnectionState::FastConnecting);
+}
+
+int WiFiConnection::findWifi(const char *ssid) {
+  for (size_t i = 0; i < this->wifis->size(); ++i) {
+    if (strcmp((*this->wifis)[i].ssid, ssid) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void WiFiConnection::setState(WiFiConnectionState newState) {
+  this->state = newState;
+  this->stepStartMillis = millis();
+}
+
+void WiFiConnection::startScan() {
+  WiFi.disconnect();
+  WiFi.scanNetworks(true);
+  this->setState(WiFiConnectionState::Scanning);
+}
+
+void WiFiConnection::readScan() {
+  int numNetworks = WiFi.scanComplete();
+  if (numNetworks == WIFI_SCAN_RUNNING) {
+    if (millis() - this->stepStartMillis > WIFI_SCAN_TIMEOUT_MILLIS) {
+      LOG_WARNING("[WiFi] Scan timed out.");
+      this->startScan();
+    }
+    return;
+  }
+
+  this->candidates.clear();
+  for (int i = 0; i < numNetworks; ++i) {
+    int wifiIndex = this->findWifi(WiFi.SSID(i).c_str());
+    if (wifiIndex >= 0) {
+      WiFiCandidate candidate;
+      candidate.wifiIndex = wifiIndex;
+      memcpy(candidate.bssid, WiFi.BSSID(i), sizeof(candidate.bssid));
+      candidate.channel = WiFi.channel(i);
+      candidate.rssi = WiFi.RSSI(i);
+      this->candidates.push_back(candidate);
+    }
+  }
+  WiFi.scanDelete();
+
+  std::sort(this->candidates.begin(), this->candidates.end(), [](const WiFiCandidate &a, const WiFiCandidate &b) {
+    return a.rssi > b.rssi;
+  });
+  Logger.printf("[WiFi] Scan found %u of the configured networks.\n", (unsigned int) this->candidates.size());
+  this->nextCandidate = 0;
+  this->connectNext();
+}
+
+void WiFiConnection::connectNext() {
+  if (this->nextCandidate >= this->candidates.size()) {
+    // none of them worked, so they are looked for again
+    this->startScan();
+    return;
+  }
+
+  const WiFiCandidate &candidate = this->candidates[this->nextCandidate++];
+  const WiFiConfig &wifi = (*this->wifis)[candidate.wifiIndex];
+  Logger.printf("[WiFi] Connecting to %s on channel %d (RSSI %d).\n", wifi.ssid, candidate.channel, candidate.rssi);
+  WiFi.begin(wifi.ssid, wifi.passphrase, candidate.channel, candidate.bssid);
+  this->setState(WiFiConnectionState::Connecting);
+}
+
+void WiFiConnection::finishConnect() {
+  this->setState(WiFiConnectionState::Connected);
+  Logger.printf("[WiFi] Connected to %s, IP address: %s.\n", WiFi.SSID().c_str(), WiFi.localIP().toString().c_str());
+
+  // written only when the access point changed, to spare the flash
+  WiFiCache current;
+  memset(&current, 0, sizeof(current));
+  current.magic = WIFI_CACHE_MAGIC;
+  strlcpy(current.ssid, WiFi.SSID().c_str(), sizeof(current.ssid));
+  memcpy(current.bssid, WiFi.BSSID(), sizeof(current.bssid));
+  current.channel = WiFi.channel();
+  if (memcmp(&current, &this->cache, sizeof(current)) == 0) {
+    return;
+  }
+
+  File file = LittleFS.open(WIFI_CACHE_PATH, "w");
+  if (!file || file.write((const uint8_t *) &current, sizeof(current)) != sizeof(current)) {
+    LOG_ERROR("[WiFi] Unable to write WiFi cache.");
+  }
+  if (file) {
+    file.close();
+  }
+  this->cache = current;
+}
+
+void WiFiConnection::handle() {
+  bool isConnected = WiFi.status() == WL_CONNECTED;
+  uint32_t elapsedMillis = millis() - this->stepStartMillis;
+
+  switch (this->state) {
+    case WiFiConnectionState::FastConnecting:
+      if (isConnected) {
+        this->finishConnect();
+      } else if (elapsedMillis > WIFI_FAST_CONNECT_TIMEOUT_MILLIS) {
+        LOG_WARNING("[WiFi] Fast connect failed, scanning.");
+        this->startScan();
+      }
+      break;
+    case WiFiConnectionState::Scanning:
+      this->readScan();
+      break;
+    case WiFiConnectionState::Connecting:
+      if (isConnected) {
+        this->finishConnect();
+      } else if (elapsedMillis > WIFI_CONNECT_TIMEOUT_MILLIS) {
+        this->connectNext();
+      }
+      break;
+    case WiFiConnectionState::Connected:
+      if (isConnected) {
+        this->stepStartMillis = millis();
+      } else if (elapsedMillis > WIFI_RECONNECT_TIMEOUT_MILLIS) {
+        LOG_WARNING("[WiFi] Connection lost, scanning.");
+        this->startScan();
+      }
+      break;
+  }
+}
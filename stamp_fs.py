@@ -1,8 +1,31 @@
+import gzip
+import os
+import shutil
+
 Import("env")
 
 print(env)
 
+STATIC_DIR = os.path.join("data", "html", "static")
+
+def compress_static_files():
+    # Content hashed bundles are served precompressed; the web server picks up
+    # the .gz variant of a requested file and sets the content encoding for it.
+    if not os.path.isdir(STATIC_DIR):
+        return
+    for name in os.listdir(STATIC_DIR):
+        path = os.path.join(STATIC_DIR, name)
+        if name.endswith(".gz") or not os.path.isfile(path):
+            continue
+        print("Compressing %s..." % path)
+        with open(path, "rb") as source, open(path + ".gz", "wb") as target:
+            # fixed mtime keeps the output stable for the same content
+            with gzip.GzipFile(filename=name, fileobj=target, mode="wb", compresslevel=9, mtime=0) as compressed:
+                shutil.copyfileobj(source, compressed)
+        os.remove(path)
+
 def before_buildfs(source, target, env):
+    compress_static_files()
     print("Stamping data...")
     env.Execute("echo -n `LC_ALL=en_US.utf8 date -u \"+%a, %d %b %Y %H:%M:%S GMT\"` > data/stamp")
 
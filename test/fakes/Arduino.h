@@ -0,0 +1,220 @@
+#ifndef KEG_SCALE__FAKES__ARDUINO_H
+#define KEG_SCALE__FAKES__ARDUINO_H
+
+// Host stand-in of the Arduino core for the native build, with the time driven by the tests.
+
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+typedef uint8_t byte;
+
+inline uint32_t fakeMillis = 0;
+
+inline void advanceMillis(uint32_t millis) {
+  fakeMillis += millis;
+}
+
+inline unsigned long millis() {
+  return fakeMillis;
+}
+
+inline unsigned long micros() {
+  return fakeMillis * 1000ul;
+}
+
+inline void yield() {}
+
+inline void delay(unsigned long millis) {
+  advanceMillis(millis);
+}
+
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+inline size_t strlcpy(char *dst, const char *src, size_t size) {
+  size_t len = strlen(src);
+  if (size > 0) {
+    size_t n = len < size - 1 ? len : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = 0;
+  }
+  return len;
+}
+#endif
+
+class String {
+
+private:
+  std::string value;
+
+public:
+  String() {}
+  String(const char *s) : value(s != nullptr ? s : "") {}
+  String(const std::string &s) : value(s) {}
+  explicit String(char c) : value(1, c) {}
+  explicit String(int v) : value(std::to_string(v)) {}
+  explicit String(unsigned int v) : value(std::to_string(v)) {}
+  explicit String(long v) : value(std::to_string(v)) {}
+  explicit String(unsigned long v) : value(std::to_string(v)) {}
+
+  const char *c_str() const { return this->value.c_str(); }
+  size_t length() const { return this->value.size(); }
+  bool reserve(size_t size) { this->value.reserve(size); return true; }
+
+  bool concat(const char *s) { this->value += s != nullptr ? s : ""; return true; }
+  bool concat(const char *s, size_t n) { this->value.append(s, n); return true; }
+  bool concat(char c) { this->value += c; return true; }
+  String &operator+=(const String &s) { this->value += s.value; return *this; }
+  String &operator+=(const char *s) { this->concat(s); return *this; }
+  String &operator+=(char c) { this->value += c; return *this; }
+
+  bool operator==(const String &s) const { return this->value == s.value; }
+  bool operator==(const char *s) const { return this->value == s; }
+  bool operator!=(const String &s) const { return this->value != s.value; }
+  bool operator!=(const char *s) const { return this->value != s; }
+  char operator[](size_t i) const { return this->value[i]; }
+};
+
+class StringSumHelper : public String {
+public:
+  StringSumHelper(const String &s) : String(s) {}
+};
+
+inline StringSumHelper operator+(const String &a, const String &b) {
+  String sum(a);
+  sum += b;
+  return sum;
+}
+
+inline StringSumHelper operator+(const String &a, const char *b) {
+  return a + String(b);
+}
+
+inline StringSumHelper operator+(const char *a, const String &b) {
+  return String(a) + b;
+}
+
+class Print {
+
+public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t c) = 0;
+
+  virtual size_t write(const uint8_t *buffer, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+      this->write(buffer[i]);
+    }
+    return size;
+  }
+
+  size_t write(const char *s) { return this->write((const uint8_t *) s, strlen(s)); }
+  size_t write(const char *buffer, size_t size) { return this->write((const uint8_t *) buffer, size); }
+
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (len < 0) {
+      return 0;
+    }
+    return this->write((const uint8_t *) buffer, (size_t) len < sizeof(buffer) ? len : sizeof(buffer) - 1);
+  }
+
+  size_t print(const char *s) { return this->write(s); }
+  size_t print(const String &s) { return this->write(s.c_str()); }
+  size_t println(const char *s = "") { return this->print(s) + this->print("\n"); }
+  size_t println(const String &s) { return this->print(s) + this->print("\n"); }
+
+  virtual void flush() {}
+};
+
+class HardwareSerial : public Print {
+
+public:
+  void begin(unsigned long baud) {}
+
+  size_t write(uint8_t c) override {
+    return fputc(c, stdout) == EOF ? 0 : 1;
+  }
+
+  using Print::write;
+};
+
+inline HardwareSerial Serial;
+
+enum rst_reason {
+  REASON_DEFAULT_RST = 0,
+  REASON_WDT_RST,
+  REASON_EXCEPTION_RST,
+  REASON_SOFT_WDT_RST,
+  REASON_SOFT_RESTART,
+  REASON_DEEP_SLEEP_AWAKE,
+  REASON_EXT_SYS_RST
+};
+
+struct rst_info {
+  uint32_t reason;
+  uint32_t exccause;
+  uint32_t epc1;
+  uint32_t epc2;
+  uint32_t epc3;
+  uint32_t excvaddr;
+  uint32_t depc;
+};
+
+#define FAKE_RTC_USER_MEMORY_BLOCKS 128
+
+// The parts of the ESP object the firmware uses. The RTC user memory survives fake resets,
+// which only change the reset info.
+class EspClass {
+
+public:
+  rst_info resetInfo = {REASON_DEFAULT_RST};
+  uint32_t rtcUserMemory[FAKE_RTC_USER_MEMORY_BLOCKS] = {};
+  uint32_t freeHeap = 40000;
+
+  uint32_t getFreeHeap() { return this->freeHeap; }
+  uint32_t getMaxFreeBlockSize() { return this->freeHeap; }
+  uint8_t getHeapFragmentation() { return 0; }
+
+  uint32_t random() { return (uint32_t) ::random(); }
+  uint32_t getCycleCount() { return (uint32_t) (micros() * 80); }
+  uint8_t getCpuFreqMHz() { return 80; }
+
+  rst_info *getResetInfoPtr() { return &this->resetInfo; }
+  String getResetReason() { return String(this->resetInfo.reason == REASON_DEFAULT_RST ? "Power On" : "Software/System restart"); }
+
+  bool rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size) {
+    if (offset * 4 + size > sizeof(this->rtcUserMemory)) {
+      return false;
+    }
+    memcpy(data, (uint8_t *) this->rtcUserMemory + offset * 4, size);
+    return true;
+  }
+
+  bool rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size) {
+    if (offset * 4 + size > sizeof(this->rtcUserMemory)) {
+      return false;
+    }
+    memcpy((uint8_t *) this->rtcUserMemory + offset * 4, data, size);
+    return true;
+  }
+
+  void restart() {}
+};
+
+inline EspClass ESP;
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (s)
+#define IRAM_ATTR
+
+#endif
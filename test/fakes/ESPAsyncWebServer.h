@@ -0,0 +1,242 @@
+#ifndef KEG_SCALE__FAKES__ESP_ASYNC_WEB_SERVER_H
+#define KEG_SCALE__FAKES__ESP_ASYNC_WEB_SERVER_H
+
+// Host stand-in of the web socket parts of ESPAsyncWebServer. Sockets are sinks which keep
+// the messages sent to all clients, and buffers are reference counted like in the library:
+// clients hold a reference for each queued message, and sockets free the unreferenced
+// buffers only when sending to all clients.
+
+#include <Arduino.h>
+#include <functional>
+#include <list>
+#include <string>
+#include <vector>
+
+typedef enum {
+  WS_DISCONNECTED,
+  WS_CONNECTED,
+  WS_DISCONNECTING
+} AwsClientStatus;
+
+typedef enum {
+  WS_EVT_CONNECT,
+  WS_EVT_DISCONNECT,
+  WS_EVT_PONG,
+  WS_EVT_ERROR,
+  WS_EVT_DATA
+} AwsEventType;
+
+typedef struct {
+  uint8_t message_opcode;
+  uint32_t num;
+  uint8_t final;
+  uint8_t masked;
+  uint8_t opcode;
+  uint64_t len;
+  uint8_t mask[4];
+  uint64_t index;
+} AwsFrameInfo;
+
+class AsyncWebSocketMessageBuffer {
+
+private:
+  std::vector<uint8_t> data;
+  bool isLocked;
+  uint32_t references;
+
+public:
+  AsyncWebSocketMessageBuffer(size_t size) : data(size + 1, 0), isLocked(false), references(0) {}
+
+  void operator++(int) { ++this->references; }
+  void operator--(int) { if (this->references > 0) { --this->references; } }
+  void lock() { this->isLocked = true; }
+  void unlock() { this->isLocked = false; }
+  uint8_t *get() { return this->data.data(); }
+  size_t length() { return this->data.size() - 1; }
+  uint32_t count() { return this->references; }
+  bool canDelete() { return !this->isLocked && this->references == 0; }
+};
+
+class AsyncWebParameter {
+
+private:
+  String paramName;
+  String paramValue;
+
+public:
+  AsyncWebParameter(const String &_name, const String &_value) : paramName(_name), paramValue(_value) {}
+
+  const String &name() const { return this->paramName; }
+  const String &value() const { return this->paramValue; }
+};
+
+class AsyncWebServerRequest {
+
+public:
+  std::vector<AsyncWebParameter> params;
+  void *_tempObject = nullptr;
+
+  AsyncWebParameter *getParam(const String &name, bool post = false, bool file = false) {
+    for (AsyncWebParameter &param : this->params) {
+      if (param.name() == name) {
+        return &param;
+      }
+    }
+    return nullptr;
+  }
+
+  void onDisconnect(std::function<void()> fn) {}
+};
+
+class AsyncWebSocketClient {
+
+private:
+  static inline uint32_t lastId = 0;
+  uint32_t clientId;
+
+public:
+  std::vector<std::string> messages;
+  // turned off by the benchmarks, so that only the allocations of the firmware are counted
+  bool isKeepingMessages = true;
+  // the buffers of the messages stay referenced until they are acknowledged, or the client is gone
+  std::vector<AsyncWebSocketMessageBuffer *> queue;
+
+  AsyncWebSocketClient() : clientId(++lastId) {}
+
+  ~AsyncWebSocketClient() {
+    this->acknowledgeAll();
+  }
+
+  // the way the TCP callbacks of the library release the buffers of the sent messages
+  void acknowledgeAll() {
+    for (AsyncWebSocketMessageBuffer *buffer : this->queue) {
+      (*buffer)--;
+    }
+    this->queue.clear();
+  }
+
+  uint32_t id() { return this->clientId; }
+
+  void text(const char *message) { this->messages.push_back(message); }
+  void text(const char *message, size_t len) { this->messages.push_back(std::string(message, len)); }
+
+  void text(AsyncWebSocketMessageBuffer *buffer) {
+    if (buffer != nullptr) {
+      (*buffer)++;
+      this->queue.push_back(buffer);
+      if (this->isKeepingMessages) {
+        this->messages.push_back(std::string((const char *) buffer->get(), buffer->length()));
+      }
+    }
+  }
+
+  int status() { return WS_CONNECTED; }
+  bool queueIsFull() { return false; }
+};
+
+class AsyncWebSocket;
+
+typedef std::function<void(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len)> AwsEventHandler;
+
+class AsyncWebSocket {
+
+private:
+  String url;
+  AwsEventHandler handler;
+  std::list<AsyncWebSocketClient *> clients;
+  std::list<AsyncWebSocketMessageBuffer *> buffers;
+  // reused for the received frames, which the library reads right out of its TCP buffers
+  std::string frame;
+
+  void cleanBuffers() {
+    this->buffers.remove_if([](AsyncWebSocketMessageBuffer *buffer) {
+      if (buffer->canDelete()) {
+        delete buffer;
+        return true;
+      }
+      return false;
+    });
+  }
+
+public:
+  // everything sent to all clients, in order
+  std::vector<std::string> messages;
+
+  AsyncWebSocket(const String &_url) : url(_url) {}
+
+  ~AsyncWebSocket() {
+    for (AsyncWebSocketMessageBuffer *buffer : this->buffers) {
+      delete buffer;
+    }
+  }
+
+  void onEvent(AwsEventHandler _handler) { this->handler = _handler; }
+
+  // connects a client the way the library does, passing the upgrade request
+  void connect(AsyncWebSocketClient *client, AsyncWebServerRequest *request) {
+    this->clients.push_back(client);
+    if (this->handler) {
+      this->handler(this, client, WS_EVT_CONNECT, request, nullptr, 0);
+    }
+  }
+
+  // delivers a single frame message of a client, in parts of the given size like TCP segments
+  void receive(AsyncWebSocketClient *client, const char *payload, size_t partSize = SIZE_MAX) {
+    std::string &data = this->frame;
+    data.assign(payload);
+    AwsFrameInfo info = {};
+    info.final = 1;
+    info.len = data.size();
+    // the library leaves room for terminating the payload
+    data.push_back(0);
+    for (size_t index = 0; index == 0 || index < info.len; index += partSize) {
+      info.index = index;
+      size_t len = info.len - index < partSize ? info.len - index : partSize;
+      this->handler(this, client, WS_EVT_DATA, &info, (uint8_t *) &data[index], len);
+    }
+  }
+
+  void disconnect(AsyncWebSocketClient *client) {
+    this->clients.remove(client);
+    if (this->handler) {
+      this->handler(this, client, WS_EVT_DISCONNECT, nullptr, nullptr, 0);
+    }
+  }
+
+  AsyncWebSocketMessageBuffer *makeBuffer(size_t size) {
+    AsyncWebSocketMessageBuffer *buffer = new AsyncWebSocketMessageBuffer(size);
+    this->buffers.push_back(buffer);
+    return buffer;
+  }
+
+  void textAll(AsyncWebSocketMessageBuffer *buffer) {
+    if (buffer == nullptr) {
+      return;
+    }
+    this->messages.push_back(std::string((const char *) buffer->get(), buffer->length()));
+    buffer->lock();
+    for (AsyncWebSocketClient *client : this->clients) {
+      if (client->status() == WS_CONNECTED) {
+        client->text(buffer);
+      }
+    }
+    buffer->unlock();
+    this->cleanBuffers();
+  }
+
+  size_t printfAll(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    this->messages.push_back(message);
+    return strlen(message);
+  }
+
+  void cleanupClients(uint16_t maxClients = 4) {}
+  size_t count() const { return this->clients.size(); }
+  const std::list<AsyncWebSocketClient *> &getClients() const { return this->clients; }
+};
+
+#endif
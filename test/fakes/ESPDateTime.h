@@ -0,0 +1,47 @@
+#ifndef KEG_SCALE__FAKES__ESP_DATE_TIME_H
+#define KEG_SCALE__FAKES__ESP_DATE_TIME_H
+
+// Host stand-in of ESPDateTime, always in UTC.
+
+#include <Arduino.h>
+
+class DateFormatter {
+
+public:
+  static constexpr const char *DATE_ONLY = "%Y-%m-%d";
+  static constexpr const char *SIMPLE = "%Y-%m-%d %H:%M:%S";
+
+  static String format(const char *format, time_t value, int offset = 0) {
+    struct tm tm;
+    char formatted[64];
+    value += offset;
+    gmtime_r(&value, &tm);
+    strftime(formatted, sizeof(formatted), format, &tm);
+    return String(formatted);
+  }
+};
+
+class DateTimeClass {
+
+private:
+  time_t time = 0;
+  unsigned long setMillis = 0;
+
+public:
+  void setTimeZone(const char *timeZone) {}
+
+  bool setTime(time_t _time, bool forceSet = false) {
+    this->time = _time;
+    this->setMillis = millis();
+    return true;
+  }
+
+  time_t now() { return this->time + (millis() - this->setMillis) / 1000; }
+  time_t getBootTime() { return this->time - this->setMillis / 1000; }
+  bool isTimeValid() { return this->time > 0; }
+  String toString() { return DateFormatter::format(DateFormatter::SIMPLE, this->now()); }
+};
+
+inline DateTimeClass DateTime;
+
+#endif
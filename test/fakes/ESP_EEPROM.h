@@ -0,0 +1,48 @@
+#ifndef KEG_SCALE__FAKES__ESP_EEPROM_H
+#define KEG_SCALE__FAKES__ESP_EEPROM_H
+
+// Host stand-in of ESP_EEPROM, where the flash is the committed copy of the data.
+
+#include <Arduino.h>
+#include <vector>
+
+class EEPROMClass {
+
+public:
+  std::vector<uint8_t> data;
+  std::vector<uint8_t> flash;
+  uint32_t numCommits = 0;
+
+  void begin(size_t size) {
+    this->data = this->flash;
+    this->data.resize(size, 0xff);
+  }
+
+  // -1 while nothing was committed, like on an erased flash, or when opened at another size than the committed one
+  int percentUsed() { return this->flash.empty() || this->flash.size() != this->data.size() ? -1 : 0; }
+
+  template<typename T> T &get(int address, T &value) {
+    memcpy(&value, this->data.data() + address, sizeof(T));
+    return value;
+  }
+
+  template<typename T> const T &put(int address, const T &value) {
+    memcpy(this->data.data() + address, &value, sizeof(T));
+    return value;
+  }
+
+  bool commit() {
+    this->flash = this->data;
+    ++this->numCommits;
+    return true;
+  }
+
+  bool wipe() {
+    this->flash.clear();
+    return true;
+  }
+};
+
+inline EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef KEG_SCALE__FAKES__FS_H
+#define KEG_SCALE__FAKES__FS_H
+
+// Only declares what the headers of the firmware refer to, the native build has no file system.
+
+#include <Arduino.h>
+
+class File {
+
+public:
+  operator bool() const { return false; }
+  size_t read(uint8_t *buffer, size_t size) { return 0; }
+  size_t write(const uint8_t *buffer, size_t size) { return 0; }
+  void close() {}
+};
+
+class FS {
+
+public:
+  File open(const char *path, const char *mode) { return File(); }
+  bool exists(const char *path) { return false; }
+  bool remove(const char *path) { return false; }
+  bool rename(const char *from, const char *to) { return false; }
+};
+
+#endif
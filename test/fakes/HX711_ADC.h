@@ -0,0 +1,54 @@
+#ifndef KEG_SCALE__FAKES__HX711_ADC_H
+#define KEG_SCALE__FAKES__HX711_ADC_H
+
+// Host stand-in of the HX711 ADC. Tests drive the load cell wired to each data pin.
+
+#include <Arduino.h>
+
+#define FAKE_LOAD_CELL_PINS 32
+
+struct FakeLoadCell {
+  float data;
+  bool hasSample;
+  bool signalTimeout;
+  bool tareTimeout;
+  bool isTareDone;
+  long tareOffset;
+  float calibrationFactor;
+};
+
+inline FakeLoadCell fakeLoadCells[FAKE_LOAD_CELL_PINS];
+
+class HX711_ADC {
+
+private:
+  FakeLoadCell &cell;
+
+public:
+  HX711_ADC(uint8_t dout, uint8_t sck) : cell(fakeLoadCells[dout % FAKE_LOAD_CELL_PINS]) {}
+
+  void setReverseOutput() {}
+  void begin(uint8_t gain) {}
+  void startMultiple(unsigned long initMillis, bool initTare) {}
+
+  uint8_t update() {
+    bool hasSample = this->cell.hasSample;
+    this->cell.hasSample = false;
+    return hasSample ? 1 : 0;
+  }
+
+  float getData() { return this->cell.data; }
+  bool getSignalTimeoutFlag() { return this->cell.signalTimeout; }
+  bool getTareTimeoutFlag() { return this->cell.tareTimeout; }
+
+  void tareNoDelay() { this->cell.isTareDone = false; }
+  bool getTareStatus() { return this->cell.isTareDone; }
+  void setTareOffset(long offset) { this->cell.tareOffset = offset; }
+  long getTareOffset() { return this->cell.tareOffset; }
+
+  void setCalFactor(float factor) { this->cell.calibrationFactor = factor; }
+  float getCalFactor() { return this->cell.calibrationFactor; }
+  float getNewCalibration(float knownMass) { return this->cell.data / knownMass; }
+};
+
+#endif
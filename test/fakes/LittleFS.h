@@ -0,0 +1,8 @@
+#ifndef KEG_SCALE__FAKES__LITTLE_FS_H
+#define KEG_SCALE__FAKES__LITTLE_FS_H
+
+#include <FS.h>
+
+inline FS LittleFS;
+
+#endif
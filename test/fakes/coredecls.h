@@ -0,0 +1,42 @@
+#ifndef KEG_SCALE__FAKES__COREDECLS_H
+#define KEG_SCALE__FAKES__COREDECLS_H
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+
+// same polynomial and bit order as the core
+inline uint32_t crc32(const void *data, size_t length, uint32_t crc = 0xffffffff) {
+  const uint8_t *bytes = (const uint8_t *) data;
+  while (length--) {
+    uint8_t c = *bytes++;
+    for (uint32_t i = 0x80; i > 0; i >>= 1) {
+      bool bit = crc & 0x80000000;
+      if (c & i) {
+        bit = !bit;
+      }
+      crc <<= 1;
+      if (bit) {
+        crc ^= 0x04c11db7;
+      }
+    }
+  }
+  return crc;
+}
+
+inline std::function<void(bool)> fakeTimeSetCallback;
+
+inline void settimeofday_cb(const std::function<void(bool)> &cb) {
+  fakeTimeSetCallback = cb;
+}
+
+inline void configTime(int timezone, int daylightOffset, const char *server1, const char *server2 = nullptr, const char *server3 = nullptr) {}
+
+// what the SNTP client does once it got the time, which the host clock already has
+inline void fakeSntpSync() {
+  if (fakeTimeSetCallback) {
+    fakeTimeSetCallback(true);
+  }
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef KEG_SCALE__FAKES__FAKE_BOARD_H
+#define KEG_SCALE__FAKES__FAKE_BOARD_H
+
+// Puts the fakes of the native build into a known state between tests.
+
+#include <Arduino.h>
+#include <coredecls.h>
+#include <ESP_EEPROM.h>
+#include <HX711_ADC.h>
+
+#include "clock.h"
+
+// a load cell which is online and reads the given data on each update
+inline void setLoadCell(uint8_t dataPin, float data) {
+  FakeLoadCell &cell = fakeLoadCells[dataPin];
+  cell.data = data;
+  cell.hasSample = true;
+  cell.signalTimeout = false;
+  cell.tareTimeout = false;
+}
+
+inline void disconnectLoadCell(uint8_t dataPin) {
+  fakeLoadCells[dataPin].signalTimeout = true;
+}
+
+inline void resetFakeBoard() {
+  for (FakeLoadCell &cell : fakeLoadCells) {
+    cell = FakeLoadCell{};
+    cell.calibrationFactor = 1.0;
+  }
+  EEPROM.flash.clear();
+  EEPROM.numCommits = 0;
+  ESP.resetInfo.reason = REASON_DEFAULT_RST;
+}
+
+// gives the clock the wall time of the host, the way NTP does on the board
+inline void syncClock() {
+  Clock.startSync();
+  fakeSntpSync();
+  Clock.handle();
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef KEG_SCALE__FAKES__FAKE_TAP_ENTRY_H
+#define KEG_SCALE__FAKES__FAKE_TAP_ENTRY_H
+
+// A tap entry and keg shared by the tests and the benchmarks.
+
+#include <ArduinoJson.h>
+
+#include "recorder.h"
+
+#define TAP_ENTRY_JSON "{\"id\":\"b1\",\"number\":12,\"name\":\"Pale Ale\",\"bottlingDate\":\"2024-05-01\",\"bottlingVolume\":19.5,\"useBottlingVolume\":false,\"tareOffset\":5,\"finalGravity\":1.0,\"abv\":5.2,\"srm\":6}"
+
+inline RecordingEntry *makeEntry() {
+  StaticJsonDocument<512> doc;
+  deserializeJson(doc, TAP_ENTRY_JSON);
+  return RecordingEntry::forTapEntry(doc.as<JsonObject>());
+}
+
+// on the scale for the given liters of beer, with a keg of 5 kg
+inline float massOf(float liters) {
+  return 5 + liters;
+}
+
+#endif
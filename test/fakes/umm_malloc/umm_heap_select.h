@@ -0,0 +1,13 @@
+#ifndef KEG_SCALE__FAKES__UMM_HEAP_SELECT_H
+#define KEG_SCALE__FAKES__UMM_HEAP_SELECT_H
+
+// the host has a single heap
+struct HeapSelectIram {
+  HeapSelectIram() {}
+};
+
+struct HeapSelectDram {
+  HeapSelectDram() {}
+};
+
+#endif
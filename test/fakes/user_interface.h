@@ -0,0 +1,15 @@
+#ifndef KEG_SCALE__FAKES__USER_INTERFACE_H
+#define KEG_SCALE__FAKES__USER_INTERFACE_H
+
+#include <Arduino.h>
+
+// one microsecond per tick, in Q12 fixed point
+inline uint32_t system_rtc_clock_cali_proc() {
+  return 1 << 12;
+}
+
+inline uint32_t system_get_rtc_time() {
+  return (uint32_t) micros();
+}
+
+#endif
@@ -0,0 +1,159 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <fake_board.h>
+#include <fake_tap_entry.h>
+#include <unity.h>
+
+#include "recorder.h"
+
+Recorder *recorder;
+
+void setUp() {
+  resetFakeBoard();
+  recorder = new Recorder();
+  recorder->load(2);
+}
+
+void tearDown() {
+  for (int i = 0; i < 2; ++i) {
+    if (recorder->hasRecording(i)) {
+      recorder->stop(i);
+    }
+  }
+  delete recorder;
+}
+
+void test_tap_entry_is_parsed_into_the_recording() {
+  RecordingEntry *entry = makeEntry();
+  TEST_ASSERT_NOT_NULL(entry);
+  TEST_ASSERT_EQUAL_STRING("Pale Ale", entry->tapEntry.name);
+  TEST_ASSERT_EQUAL(12, entry->tapEntry.number);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 19.5, entry->tapEntry.bottlingVolume);
+  TEST_ASSERT_EQUAL(RECORDING_ENTRY_NUM_RAW_DATA_ITEMS, entry->latestValue);
+  delete entry;
+}
+
+void test_points_are_not_recorded_without_time() {
+  TEST_ASSERT_FALSE(Clock.isValid());
+  TEST_ASSERT_TRUE(recorder->start(0, makeEntry(), massOf(19)));
+  TEST_ASSERT_FALSE(recorder->update(0, massOf(18)));
+}
+
+void test_each_scale_has_its_own_recording() {
+  TEST_ASSERT_TRUE(recorder->start(0, makeEntry(), massOf(19)));
+  TEST_ASSERT_FALSE(recorder->hasRecording(1));
+  TEST_ASSERT_TRUE(recorder->start(1, makeEntry(), massOf(19)));
+  TEST_ASSERT_TRUE(recorder->update(1, massOf(18)));
+  TEST_ASSERT_TRUE(recorder->update(0, massOf(18)));
+}
+
+void test_start_without_entry_only_continues() {
+  TEST_ASSERT_FALSE(recorder->start(0, nullptr, massOf(19)));
+  TEST_ASSERT_TRUE(recorder->start(0, makeEntry(), massOf(19)));
+  recorder->pause(0);
+  TEST_ASSERT_TRUE(recorder->isPaused(0));
+  TEST_ASSERT_TRUE(recorder->start(0, nullptr, massOf(19)));
+  TEST_ASSERT_FALSE(recorder->isPaused(0));
+}
+
+void test_volume_only_decreases() {
+  recorder->start(0, makeEntry(), massOf(19));
+  TEST_ASSERT_TRUE(recorder->update(0, massOf(18)));
+  // the same point again, and a larger volume
+  TEST_ASSERT_FALSE(recorder->update(0, massOf(18)));
+  TEST_ASSERT_FALSE(recorder->update(0, massOf(18.5)));
+  TEST_ASSERT_TRUE(recorder->update(0, massOf(17.5)));
+  // out of the measured range
+  TEST_ASSERT_FALSE(recorder->update(0, massOf(-1)));
+}
+
+void test_paused_recording_is_not_updated() {
+  recorder->start(0, makeEntry(), massOf(19));
+  recorder->pause(0);
+  TEST_ASSERT_FALSE(recorder->update(0, massOf(18)));
+}
+
+void test_data_is_rendered_since_the_given_time() {
+  recorder->start(0, makeEntry(), massOf(19));
+  time_t first = Clock.now();
+  recorder->update(0, massOf(18));
+  advanceMillis(5000);
+  recorder->update(0, massOf(17));
+
+  char buffer[256];
+  JsonWriter writer(buffer, sizeof(buffer));
+  writer.beginObject();
+  recorder->renderData(0, writer, first + 5);
+  writer.endObject();
+  String expected = "{\"data\":{\"" + String((long) first + 5) + "\":17}}";
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), buffer);
+}
+
+uint32_t recordingIdOf(int index) {
+  char buffer[64];
+  JsonWriter writer(buffer, sizeof(buffer));
+  writer.beginObject();
+  recorder->renderDetails(index, writer, false);
+  writer.endObject();
+  uint32_t recordingId = 0;
+  sscanf(buffer, "{\"recordingId\":%u}", &recordingId);
+  return recordingId;
+}
+
+void test_resume_cursors_expire_only_with_missed_pours() {
+  recorder->start(0, makeEntry(), massOf(19));
+  recorder->update(0, massOf(18));
+  time_t since = Clock.now();
+  uint32_t recordingId = recordingIdOf(0);
+
+  // an idle keg
+  advanceMillis(2 * 3600 * 1000);
+  TEST_ASSERT_TRUE(recorder->canResume(0, recordingId, since));
+  TEST_ASSERT_FALSE(recorder->canResume(0, recordingId + 1, since));
+  recorder->update(0, massOf(17.9));
+  TEST_ASSERT_TRUE(recorder->canResume(0, recordingId, since));
+
+  // pouring for longer than the cursors last
+  for (int i = 2; i <= 10; ++i) {
+    advanceMillis(600 * 1000);
+    recorder->update(0, massOf(18 - i * 0.1));
+  }
+  TEST_ASSERT_FALSE(recorder->canResume(0, recordingId, since));
+  TEST_ASSERT_TRUE(recorder->canResume(0, recordingId, Clock.now() - 600));
+}
+
+void test_uploaded_recording_keeps_its_points() {
+  StaticJsonDocument<1024> doc;
+  deserializeJson(doc, "{\"tapEntry\":" TAP_ENTRY_JSON ",\"startDateTime\":\"2024-05-02 10:00:00\",\"isPaused\":false,\"data\":{\"1714644000\":19,\"1714647600\":18.5,\"1\":99}}");
+  RecordingEntry *entry = RecordingEntry::fromJson(doc.as<JsonObject>());
+  TEST_ASSERT_NOT_NULL(entry);
+  TEST_ASSERT_EQUAL(1714644000, entry->rawData[19 * MEASURED_POINTS_IN_LITERS]);
+  TEST_ASSERT_EQUAL(1714647600, entry->rawData[(int) (18.5 * MEASURED_POINTS_IN_LITERS)]);
+
+  TEST_ASSERT_TRUE(recorder->putEntry(0, entry));
+  // taken by the first one, the second is freed
+  TEST_ASSERT_FALSE(recorder->putEntry(0, RecordingEntry::fromJson(doc.as<JsonObject>())));
+}
+
+void test_stop_ends_the_recording() {
+  recorder->start(0, makeEntry(), massOf(19));
+  recorder->stop(0);
+  TEST_ASSERT_FALSE(recorder->hasRecording(0));
+  TEST_ASSERT_FALSE(recorder->update(0, massOf(18)));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_tap_entry_is_parsed_into_the_recording);
+  RUN_TEST(test_points_are_not_recorded_without_time);
+  syncClock();
+  RUN_TEST(test_each_scale_has_its_own_recording);
+  RUN_TEST(test_start_without_entry_only_continues);
+  RUN_TEST(test_volume_only_decreases);
+  RUN_TEST(test_paused_recording_is_not_updated);
+  RUN_TEST(test_data_is_rendered_since_the_given_time);
+  RUN_TEST(test_resume_cursors_expire_only_with_missed_pours);
+  RUN_TEST(test_uploaded_recording_keeps_its_points);
+  RUN_TEST(test_stop_ends_the_recording);
+  return UNITY_END();
+}
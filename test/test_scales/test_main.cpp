@@ -0,0 +1,256 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <fake_board.h>
+#include <fake_tap_entry.h>
+#include <string>
+#include <unity.h>
+
+#include "scales.h"
+
+#define DATA_PIN 4
+
+Config config;
+PersistentConfig *persistentConfig;
+Recorder *recorder;
+Scales *scales;
+
+void loopScales(int numLoops = 1) {
+  for (int i = 0; i < numLoops; ++i) {
+    scales->handle();
+    advanceMillis(100);
+  }
+}
+
+std::string lastRender() {
+  std::vector<std::string> &messages = scales->getSocket()->messages;
+  return messages.empty() ? "" : messages.back();
+}
+
+bool isRendered(const char *part) {
+  return lastRender().find(part) != std::string::npos;
+}
+
+bool runCommand(const char *json, String &errorMessage) {
+  StaticJsonDocument<1024> doc;
+  deserializeJson(doc, json);
+  JsonObject command = doc.as<JsonObject>();
+  return scales->processCommand(command, errorMessage);
+}
+
+bool runCommand(const char *json) {
+  String errorMessage;
+  return runCommand(json, errorMessage);
+}
+
+void setUp() {
+  resetFakeBoard();
+  setLoadCell(DATA_PIN, massOf(19));
+
+  ScaleConfig scaleConfig = {};
+  strlcpy(scaleConfig.label, "Left", sizeof(scaleConfig.label));
+  scaleConfig.dataPin = DATA_PIN;
+  scaleConfig.clockPin = DATA_PIN + 1;
+  scaleConfig.gain = 128;
+  config.scales.assign(1, scaleConfig);
+
+  persistentConfig = new PersistentConfig();
+  persistentConfig->load(config.scales);
+  recorder = new Recorder();
+  recorder->load(config.scales.size());
+  scales = new Scales();
+  scales->begin(config, *persistentConfig, *recorder);
+}
+
+void tearDown() {
+  if (recorder->hasRecording(0)) {
+    recorder->stop(0);
+  }
+  // the scales are left behind, as they are never destroyed on the board either
+  scales = nullptr;
+  recorder = nullptr;
+  persistentConfig = nullptr;
+}
+
+void test_scale_starts_offline_then_goes_to_standby() {
+  loopScales();
+  TEST_ASSERT_TRUE(isRendered("\"name\":\"offline\""));
+  loopScales(2);
+  TEST_ASSERT_TRUE(isRendered("\"name\":\"standby\""));
+}
+
+void test_scale_stays_offline_without_signal() {
+  disconnectLoadCell(DATA_PIN);
+  loopScales(3);
+  TEST_ASSERT_TRUE(isRendered("\"name\":\"offline\""));
+}
+
+void test_tare_continues_with_live_measurement() {
+  loopScales(3);
+  TEST_ASSERT_TRUE(runCommand("{\"action\":\"tare\",\"index\":0}"));
+  loopScales();
+  TEST_ASSERT_TRUE(isRendered("\"name\":\"tare\""));
+
+  fakeLoadCells[DATA_PIN].tareOffset = 42;
+  fakeLoadCells[DATA_PIN].isTareDone = true;
+  loopScales(2);
+  TEST_ASSERT_TRUE(isRendered("\"name\":\"liveMeasurement\""));
+  TEST_ASSERT_EQUAL(42, persistentConfig->getCalibrationForScale(0)->tareOffset);
+}
+
+void test_calibrations_of_the_previous_format_are_migrated() {
+  // a tare offset and a calibration factor per scale, in the order of the scales
+  ScaleCalibration legacyCalibration = {42, 2.5};
+  EEPROM.flash.assign(sizeof(ScaleCalibration), 0);
+  memcpy(EEPROM.flash.data(), &legacyCalibration.tareOffset, sizeof(legacyCalibration.tareOffset));
+  memcpy(EEPROM.flash.data() + sizeof(legacyCalibration.tareOffset), &legacyCalibration.calibrationFactor, sizeof(legacyCalibration.calibrationFactor));
+
+  PersistentConfig migrated;
+  migrated.load(config.scales);
+  TEST_ASSERT_EQUAL(42, migrated.getCalibrationForScale(0)->tareOffset);
+  TEST_ASSERT_EQUAL_FLOAT(2.5, migrated.getCalibrationForScale(0)->calibrationFactor);
+
+  PersistentConfig reloaded;
+  reloaded.load(config.scales);
+  TEST_ASSERT_EQUAL(42, reloaded.getCalibrationForScale(0)->tareOffset);
+  TEST_ASSERT_EQUAL_FLOAT(2.5, reloaded.getCalibrationForScale(0)->calibrationFactor);
+}
+
+void test_recording_can_be_paused_continued_and_stopped() {
+  loopScales(3);
+  TEST_ASSERT_TRUE(runCommand("{\"action\":\"startRecording\",\"index\":0,\"tapEntry\":" TAP_ENTRY_JSON "}"));
+  loopScales();
+  TEST_ASSERT_TRUE(isRendered("\"name\":\"recording\""));
+  TEST_ASSERT_TRUE(isRendered("\"Pale Ale\""));
+
+  setLoadCell(DATA_PIN, massOf(18));
+  loopScales();
+  TEST_ASSERT_TRUE(isRendered("\"isFull\":false"));
+  TEST_ASSERT_TRUE(isRendered(":18}"));
+
+  TEST_ASSERT_TRUE(runCommand("{\"action\":\"pauseRecording\",\"index\":0}"));
+  loopScales();
+  TEST_ASSERT_TRUE(isRendered("\"isPaused\":true"));
+  TEST_ASSERT_TRUE(runCommand("{\"action\":\"continueRecording\",\"index\":0}"));
+  loopScales();
+  TEST_ASSERT_TRUE(isRendered("\"isPaused\":false"));
+
+  TEST_ASSERT_TRUE(runCommand("{\"action\":\"stopRecording\",\"index\":0}"));
+  loopScales(3);
+  TEST_ASSERT_TRUE(isRendered("\"name\":\"standby\""));
+  TEST_ASSERT_FALSE(recorder->hasRecording(0));
+}
+
+void test_recording_continues_after_going_offline() {
+  loopScales(3);
+  runCommand("{\"action\":\"startRecording\",\"index\":0,\"tapEntry\":" TAP_ENTRY_JSON "}");
+  loopScales();
+
+  disconnectLoadCell(DATA_PIN);
+  loopScales(2);
+  TEST_ASSERT_TRUE(isRendered("\"name\":\"offline\""));
+  TEST_ASSERT_TRUE(recorder->hasRecording(0));
+
+  setLoadCell(DATA_PIN, massOf(19));
+  loopScales(2);
+  TEST_ASSERT_TRUE(isRendered("\"name\":\"recording\""));
+}
+
+void test_invalid_commands_are_rejected() {
+  String errorMessage;
+  TEST_ASSERT_FALSE(runCommand("{\"action\":\"tare\"}", errorMessage));
+  TEST_ASSERT_EQUAL_STRING("[Scales] Invalid scale command format.", errorMessage.c_str());
+  TEST_ASSERT_FALSE(runCommand("{\"action\":\"tare\",\"index\":1}", errorMessage));
+  TEST_ASSERT_EQUAL_STRING("[Scales] Invalid scale index in command: 1", errorMessage.c_str());
+  TEST_ASSERT_FALSE(runCommand("{\"action\":\"brew\",\"index\":0}", errorMessage));
+  TEST_ASSERT_EQUAL_STRING("[Scales] Unknown scale command action: brew", errorMessage.c_str());
+  TEST_ASSERT_FALSE(runCommand("{\"action\":\"calibrate\",\"index\":0}", errorMessage));
+  TEST_ASSERT_EQUAL_STRING("[Scales] Invalid known mass for calibration of scale 0", errorMessage.c_str());
+  TEST_ASSERT_FALSE(runCommand("{\"action\":\"calibrate\",\"index\":0,\"knownMass\":-500}", errorMessage));
+}
+
+void test_uploaded_recording_is_restored() {
+  loopScales(3);
+  TEST_ASSERT_TRUE(runCommand("{\"action\":\"putRecordingEntry\",\"index\":0,\"recordingEntry\":{\"tapEntry\":" TAP_ENTRY_JSON ",\"startDateTime\":\"2024-05-02 10:00:00\",\"isPaused\":false,\"data\":{\"1714644000\":19}}}"));
+  loopScales();
+  TEST_ASSERT_TRUE(isRendered("\"name\":\"recording\""));
+  TEST_ASSERT_TRUE(isRendered("\"1714644000\":19"));
+}
+
+void test_socket_clients_get_renders_and_batch_results() {
+  loopScales(3);
+  AsyncWebSocketClient client;
+  AsyncWebServerRequest request;
+  scales->getSocket()->connect(&client, &request);
+  TEST_ASSERT_EQUAL(1, client.messages.size());
+  TEST_ASSERT_TRUE(client.messages.back().find("\"name\":\"standby\"") != std::string::npos);
+
+  scales->getSocket()->receive(&client, "{\"id\":7,\"commands\":[{\"action\":\"tare\",\"index\":0},{\"action\":\"brew\",\"index\":0}]}");
+  std::string &response = client.messages.back();
+  TEST_ASSERT_TRUE(response.find("\"type\":\"results\"") != std::string::npos);
+  TEST_ASSERT_TRUE(response.find("{\"type\":\"ack\"}") != std::string::npos);
+  TEST_ASSERT_TRUE(response.find("\"type\":\"error\"") != std::string::npos);
+  TEST_ASSERT_TRUE(response.find("\"id\":7") != std::string::npos);
+}
+
+void test_new_clients_get_the_current_weight_in_standby() {
+  loopScales(3);
+  AsyncWebSocketClient client;
+  AsyncWebServerRequest request;
+  scales->getSocket()->connect(&client, &request);
+  TEST_ASSERT_TRUE(client.messages.back().find("\"data\":24") != std::string::npos);
+
+  setLoadCell(DATA_PIN, massOf(10));
+  loopScales();
+  AsyncWebSocketClient laterClient;
+  scales->getSocket()->connect(&laterClient, &request);
+  TEST_ASSERT_TRUE(laterClient.messages.back().find("\"data\":15") != std::string::npos);
+}
+
+void test_commands_of_a_batch_wait_for_the_previous_one_of_the_scale() {
+  loopScales(3);
+  AsyncWebSocketClient client;
+  AsyncWebServerRequest request;
+  scales->getSocket()->connect(&client, &request);
+
+  scales->getSocket()->receive(&client, "{\"id\":8,\"commands\":[{\"action\":\"tare\",\"index\":0},{\"action\":\"liveMeasurement\",\"index\":0}]}");
+  std::string &response = client.messages.back();
+  TEST_ASSERT_TRUE(response.find("{\"type\":\"ack\"}") != std::string::npos);
+  TEST_ASSERT_TRUE(response.find("still pending") != std::string::npos);
+  loopScales();
+  TEST_ASSERT_TRUE(isRendered("\"name\":\"tare\""));
+}
+
+void test_messages_are_collected_from_their_parts() {
+  loopScales(3);
+  AsyncWebSocketClient client;
+  AsyncWebServerRequest request;
+  scales->getSocket()->connect(&client, &request);
+
+  const char *payload = "{\"id\":9,\"commands\":[{\"action\":\"startRecording\",\"index\":0,\"tapEntry\":" TAP_ENTRY_JSON "},"
+    "{\"action\":\"startRecording\",\"index\":0,\"tapEntry\":" TAP_ENTRY_JSON "}]}";
+  scales->getSocket()->receive(&client, payload, 100);
+  std::string &response = client.messages.back();
+  TEST_ASSERT_TRUE(response.find("\"id\":9") != std::string::npos);
+  TEST_ASSERT_TRUE(response.find("{\"type\":\"ack\"}") != std::string::npos);
+  loopScales();
+  TEST_ASSERT_TRUE(isRendered("\"name\":\"recording\""));
+  scales->getSocket()->disconnect(&client);
+}
+
+int main(int argc, char **argv) {
+  syncClock();
+  UNITY_BEGIN();
+  RUN_TEST(test_scale_starts_offline_then_goes_to_standby);
+  RUN_TEST(test_scale_stays_offline_without_signal);
+  RUN_TEST(test_tare_continues_with_live_measurement);
+  RUN_TEST(test_calibrations_of_the_previous_format_are_migrated);
+  RUN_TEST(test_recording_can_be_paused_continued_and_stopped);
+  RUN_TEST(test_recording_continues_after_going_offline);
+  RUN_TEST(test_invalid_commands_are_rejected);
+  RUN_TEST(test_uploaded_recording_is_restored);
+  RUN_TEST(test_socket_clients_get_renders_and_batch_results);
+  RUN_TEST(test_new_clients_get_the_current_weight_in_standby);
+  RUN_TEST(test_commands_of_a_batch_wait_for_the_previous_one_of_the_scale);
+  RUN_TEST(test_messages_are_collected_from_their_parts);
+  return UNITY_END();
+}